@@ -1,3 +1,9 @@
+// Element type of the disparity maps, the host sets it to match DispMap
+#ifndef DISP_T
+#define DISP_T uchar
+#define DISP_MAX 255
+#endif
+
 // Define kernel for calculating mean
 double calculateMean(int x, int y, int d, int width, int height, int halfWinSize, __global const unsigned char* img)
 {
@@ -50,7 +56,7 @@ double calculateZncc(int x, int y, int d, double mean1, double mean2, int width,
 // Kernel for ZNCC disparity calculation
 __kernel void zncc_kernel(global const unsigned char* leftImg,
                         global const unsigned char* rightImg,
-                        global unsigned char* disparityImg,
+                        global DISP_T* disparityImg,
                         global double* meanVals,
                         global double* znccVals,
                         int width, int height, int winSize, int maxDisp)
@@ -84,5 +90,5 @@ __kernel void zncc_kernel(global const unsigned char* leftImg,
         }
     }
 
-    disparityImg[idx] = (unsigned char)bestDisp;
+    disparityImg[idx] = (DISP_T)bestDisp;
 }
\ No newline at end of file
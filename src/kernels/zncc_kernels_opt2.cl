@@ -1,3 +1,9 @@
+// Element type of the disparity maps, the host sets it to match DispMap
+#ifndef DISP_T
+#define DISP_T uchar
+#define DISP_MAX 255
+#endif
+
 __kernel void calculateMean(int x, int y, int d, int width, int height, int halfWinSize, __global const unsigned char* img, __local double* mean)
 {
     int yy_0 = max(0, y - halfWinSize);
@@ -93,7 +99,7 @@ __kernel void calculateZncc(int x, int y, int d, double mean1, double mean2, int
 // Kernel for ZNCC disparity calculation
 __kernel void zncc_kernel(global const unsigned char* leftImg,
                         global const unsigned char* rightImg,
-                        global unsigned char* disparityImg,
+                        global DISP_T* disparityImg,
                         int width, int height, int winSize, int maxDisp)
 {
     // Get global thread ID
@@ -140,5 +146,5 @@ __kernel void zncc_kernel(global const unsigned char* leftImg,
         }
     }
 
-    disparityImg[idx] = (unsigned char)bestDisp;
+    disparityImg[idx] = (DISP_T)bestDisp;
 }
\ No newline at end of file
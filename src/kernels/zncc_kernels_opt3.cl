@@ -1,3 +1,9 @@
+// Element type of the disparity maps, the host sets it to match DispMap
+#ifndef DISP_T
+#define DISP_T uchar
+#define DISP_MAX 255
+#endif
+
 __kernel void calculateMean(int x, int y, int d, int width, int height, int halfWinSize, __global const unsigned char* img, __local double* mean)
 {
     int yy_0 = max(0, y - halfWinSize);
@@ -120,8 +126,8 @@ __kernel void calculateZncc2(int x, int y, int d, double mean1, double mean2, in
 // Kernel for ZNCC disparity calculation
 __kernel void zncc_kernel(global const unsigned char* leftImg,
                         global const unsigned char* rightImg,
-                        global unsigned char* leftDispImg,
-                        global unsigned char* rightDispImg,
+                        global DISP_T* leftDispImg,
+                        global DISP_T* rightDispImg,
                         int width, int height, int winSize, int maxDisp)
 {
     // Get global thread ID
@@ -181,6 +187,6 @@ __kernel void zncc_kernel(global const unsigned char* leftImg,
         // if (x == 10 && y == 10 && d == 15)
         //     printf("ZNCC: %f\n", leftZnccVals[d]);
     }
-    leftDispImg[idx] = (unsigned char)leftBestDisp;
-    rightDispImg[idx] = (unsigned char)rightBestDisp;
+    leftDispImg[idx] = (DISP_T)leftBestDisp;
+    rightDispImg[idx] = (DISP_T)rightBestDisp;
 }
\ No newline at end of file
@@ -1,3 +1,9 @@
+// Element type of the disparity maps, the host sets it to match DispMap
+#ifndef DISP_T
+#define DISP_T uchar
+#define DISP_MAX 255
+#endif
+
 pipe double mean_pipe __attribute__((xcl_reqd_pipe_depth(256)));
 // pipe double mean_pipe_right __attribute__((xcl_reqd_pipe_depth(256)));
 
@@ -92,7 +98,7 @@ __kernel void calculate_zncc(global const unsigned char* leftImg,
 
 // Kernel for ZNCC disparity calculation
 __kernel __attribute__ ((reqd_work_group_size(1, 1, 1)))
-__kernel void zncc_kernel(global unsigned char* disparityImg, int width, int maxDisp)
+__kernel void zncc_kernel(global DISP_T* disparityImg, int width, int maxDisp)
 {
     // Get global thread ID
     int idx = get_global_id(0);
@@ -113,5 +119,5 @@ __kernel void zncc_kernel(global unsigned char* disparityImg, int width, int max
         }
     }
 
-    disparityImg[idx] = (unsigned char)bestDisp;
+    disparityImg[idx] = (DISP_T)bestDisp;
 }
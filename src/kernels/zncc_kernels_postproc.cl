@@ -0,0 +1,64 @@
+// Element type of the disparity maps, the host sets it to match DispMap
+#ifndef DISP_T
+#define DISP_T uchar
+#define DISP_MAX 255
+#endif
+
+// Post-processing of the disparity maps, one work-item per pixel, same results as crosscheck,
+// fillOcclusion and normalizeMap on the host
+
+// Kernel for cross checking, pixels whose left and right disparities disagree by more than ccThresh become 0
+__kernel void crosscheck_kernel(__global const DISP_T* dispMapLeft,
+                                __global const DISP_T* dispMapRight,
+                                __global DISP_T* result,
+                                int ccThresh)
+{
+    int idx = get_global_id(0);
+
+    int dispLeft = dispMapLeft[idx];
+    result[idx] = dispLeft;
+    if (idx - dispLeft < 0)
+        return;
+
+    int diff = dispMapRight[idx - dispLeft] - dispLeft;
+    if (diff > ccThresh || -diff > ccThresh)
+        result[idx] = 0;
+}
+
+// Kernel for occlusion filling, 0 pixels take the average of the nearest non-zero pixels of their row
+__kernel void fill_occlusion_kernel(__global const DISP_T* dispMap,
+                                    __global DISP_T* result,
+                                    int width)
+{
+    int idx = get_global_id(0);
+    int x = idx % width;
+    int y = idx / width;
+
+    int disp = dispMap[idx];
+    if (disp != 0)
+    {
+        result[idx] = disp;
+        return;
+    }
+
+    int left = x;
+    int right = x;
+    while (left >= 0 && dispMap[y * width + left] == 0)
+        left--;
+    while (right < width && dispMap[y * width + right] == 0)
+        right++;
+
+    // Same neighbour indices as fillOcclusion
+    int idxLeft = max(0, y * width + left);
+    int idxRight = min(width - 1, y * width + right);
+    result[idx] = (DISP_T)((dispMap[idxLeft] + dispMap[idxRight]) / 2);
+}
+
+// Kernel for map normalization, disparities scaled from [0, maxDisp] to [0, DISP_MAX]
+__kernel void normalize_kernel(__global const DISP_T* dispMap,
+                               __global DISP_T* result,
+                               int maxDisp)
+{
+    int idx = get_global_id(0);
+    result[idx] = (DISP_T)(dispMap[idx] * (double)DISP_MAX / maxDisp);
+}
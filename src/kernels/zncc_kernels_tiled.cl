@@ -0,0 +1,130 @@
+// Element type of the disparity maps, the host sets it to match DispMap
+#ifndef DISP_T
+#define DISP_T uchar
+#define DISP_MAX 255
+#endif
+
+// Same operation order as calculateMean / calculateZncc on the host, so the maps match zncc_single exactly
+#pragma OPENCL FP_CONTRACT OFF
+
+// Copy the image area with top-left corner (tileX, tileY) into a local tile, pixels outside the image are 0.
+// All work-items of the group share the copy, each one loads every groupSize-th pixel.
+void loadTile(__global const unsigned char* img, __local unsigned char* tile, int tileX, int tileY, int tileWidth, int tileHeight, int width, int height, int localId, int groupSize)
+{
+    for (int idx = localId; idx < tileWidth * tileHeight; idx += groupSize)
+    {
+        int xj = tileX + idx % tileWidth;
+        int yj = tileY + idx / tileWidth;
+        tile[idx] = (xj >= 0 && xj < width && yj >= 0 && yj < height) ? img[yj * width + xj] : 0;
+    }
+}
+
+// Mean of the window centred on (x, y) clipped to the image, read from a tile at (tileX, tileY)
+double tileMean(int x, int y, int width, int height, int winSize, __local const unsigned char* tile, int tileX, int tileY, int tileWidth)
+{
+    const int halfWinSize = winSize / 2;
+    double sum = 0.0;
+    int count = 0;
+
+    for (int j = -halfWinSize; j < winSize - halfWinSize; j++)
+    {
+        for (int i = -halfWinSize; i < winSize - halfWinSize; i++)
+        {
+            int xj = x + i;
+            int yj = y + j;
+            if (xj >= 0 && xj < width && yj >= 0 && yj < height)
+            {
+                sum += tile[(yj - tileY) * tileWidth + xj - tileX];
+                count++;
+            }
+        }
+    }
+
+    return sum / (double)count;
+}
+
+// ZNCC of the left window at (x, y) and the right window at (x - d, y), over the pixels both have in the image
+double tileZncc(int x, int y, int d, double mean1, double mean2, int width, int height, int winSize,
+                __local const unsigned char* leftTile, int leftX, int leftWidth,
+                __local const unsigned char* rightTile, int rightX, int rightWidth, int tileY)
+{
+    const int halfWinSize = winSize / 2;
+    double num = 0.0;
+    double denom1 = 0.0;
+    double denom2 = 0.0;
+
+    for (int j = -halfWinSize; j < winSize - halfWinSize; j++)
+    {
+        for (int i = -halfWinSize; i < winSize - halfWinSize; i++)
+        {
+            int xj1 = x + i;
+            int xj2 = x + i - d;
+            int yj = y + j;
+            if (xj1 >= 0 && xj1 < width && xj2 >= 0 && xj2 < width && yj >= 0 && yj < height)
+            {
+                double val1 = leftTile[(yj - tileY) * leftWidth + xj1 - leftX] - mean1;
+                double val2 = rightTile[(yj - tileY) * rightWidth + xj2 - rightX] - mean2;
+                num += val1 * val2;
+                denom1 += val1 * val1;
+                denom2 += val2 * val2;
+            }
+        }
+    }
+
+    double denom = sqrt(denom1 * denom2);
+    return denom == 0.0 ? 0.0 : num / denom;
+}
+
+// Kernel for ZNCC disparity calculation on 2D work-groups, one work-item per pixel. The group loads the
+// left tile with the window halo, and the right tile widened by maxDisp - 1 to the left, into local
+// memory once, and all disparities are evaluated from there. The tiles are sized by the host:
+// leftTile is (local width + winSize - 1) x (local height + winSize - 1), rightTile is maxDisp - 1 wider.
+__kernel void zncc_tiled_kernel(__global const unsigned char* leftImg,
+                                __global const unsigned char* rightImg,
+                                __global DISP_T* disparityImg,
+                                int width, int height, int winSize, int maxDisp,
+                                __local unsigned char* leftTile,
+                                __local unsigned char* rightTile)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const int halfWinSize = winSize / 2;
+
+    const int leftX = (int)(get_group_id(0) * get_local_size(0)) - halfWinSize;
+    const int rightX = leftX - (maxDisp - 1);
+    const int tileY = (int)(get_group_id(1) * get_local_size(1)) - halfWinSize;
+    const int leftWidth = get_local_size(0) + winSize - 1;
+    const int rightWidth = leftWidth + maxDisp - 1;
+    const int tileHeight = get_local_size(1) + winSize - 1;
+
+    const int localId = get_local_id(1) * get_local_size(0) + get_local_id(0);
+    const int groupSize = get_local_size(0) * get_local_size(1);
+
+    loadTile(leftImg, leftTile, leftX, tileY, leftWidth, tileHeight, width, height, localId, groupSize);
+    loadTile(rightImg, rightTile, rightX, tileY, rightWidth, tileHeight, width, height, localId, groupSize);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // The global range is rounded up to whole groups, the extra work-items only helped loading
+    if (x >= width || y >= height)
+        return;
+
+    double maxZncc = -1.0;
+    int bestDisp = 0;
+
+    double mean1 = tileMean(x, y, width, height, winSize, leftTile, leftX, tileY, leftWidth);
+
+    for (int d = 0; d < maxDisp; d++)
+    {
+        double mean2 = tileMean(x - d, y, width, height, winSize, rightTile, rightX, tileY, rightWidth);
+
+        double znccVal = tileZncc(x, y, d, mean1, mean2, width, height, winSize, leftTile, leftX, leftWidth, rightTile, rightX, rightWidth, tileY);
+
+        if (znccVal > maxZncc)
+        {
+            maxZncc = znccVal;
+            bestDisp = d;
+        }
+    }
+
+    disparityImg[y * width + x] = (DISP_T)bestDisp;
+}
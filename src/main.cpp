@@ -6,13 +6,25 @@
 #include <iostream>
 #include <fstream>
 #include "utils/datatools.hpp"
+#include "utils/async_writer.hpp"
 #include "zncc/zncc.hpp"
+#include "zncc/zncc_pyramid.hpp"
+#include "zncc/zncc_batch.hpp"
+#include "zncc/zncc_strips.hpp"
 
 namespace fs = filesystem;
 
 void printHelp(int argc, char **argv)
 {
-     cout << "Usage: mpp_project.exe <path_to_data_dir>\n";
+     cout << "Usage: mpp_project.exe <path_to_data_dir> [--cache-tiling] [--bounded-search]\n"
+          << "       mpp_project.exe --batch <dataset_or_sequence_dir> [output_dir] [png|raw] [parabola|equiangular] [--opencl-stream]\n"
+          << "       mpp_project.exe --strips <left.pgm|raw> <right.pgm|raw> <out.pgm|raw> [memory_budget_mb]\n"
+          << "       mpp_project.exe --simd-benchmark <data_dir> [win_size] [max_disp]\n"
+          << "Inputs can be png, 8-bit pgm or uint8 raw images, raw output skips the png encoding\n"
+          << "Strip mode matches very large pgm or raw pairs in bands of rows sized to the memory budget (default 256 MB)\n"
+          << "--opencl-stream streams a left/ right/ sequence through the OpenCL device, decoding each frame as it is needed\n"
+          << "--cache-tiling runs the per-pixel CPU methods of the grid search on cache-sized tiles\n"
+          << "--bounded-search adds INTEGRAL to the grid search and runs it in two passes with early termination\n";
 
      auto cwd = fs::current_path();
      cout << "current working dir " << cwd << "\n";
@@ -25,14 +37,15 @@ void printHelp(int argc, char **argv)
           cout << argv[i] << "\n";
 }
 
-ZnccResult run_zncc(const Image &leftImg, const Image &rightImg, ZnccParams znccParams)
+// The downsampled images are cached in leftImg and rightImg, so later runs at the same resizeFactor reuse them
+ZnccResult run_zncc(Image &leftImg, Image &rightImg, ZnccParams znccParams)
 {
      Timer timer;
-     auto leftImg_ = znccParams.resizeFactor != 1 ? downsample(leftImg.dataGray, leftImg.width, leftImg.height, znccParams.resizeFactor) : leftImg.dataGray;
-     auto rightImg_ = znccParams.resizeFactor != 1 ? downsample(rightImg.dataGray, rightImg.width, rightImg.height, znccParams.resizeFactor) : rightImg.dataGray;
+     const auto &leftImg_ = grayLevel(leftImg, znccParams.resizeFactor);
+     const auto &rightImg_ = grayLevel(rightImg, znccParams.resizeFactor);
 
      cout << "Running ZNCC with method " << ZnccMethodToString(znccParams.method) << "\n";
-     auto result = zncc_pipeline(leftImg_, rightImg_, znccParams);
+     auto result = znccParams.pyramidLevels > 1 ? zncc_pyramid_pipeline(leftImg_, rightImg_, znccParams) : zncc_pipeline(leftImg_, rightImg_, znccParams);
      return result;
 }
 
@@ -41,25 +54,132 @@ void run_post_proc(ZnccResult &result, ZnccParams &params)
      post_proc_pipeline(result, params);
 }
 
-void run_logger(ZnccResult &result, ZnccParams &params, ofstream &csv_log)
+// Images and the log line are handed to the writer, so encoding overlaps the next ZNCC run
+void run_logger(ZnccResult &result, ZnccParams &params, AsyncWriter &writer)
 {
      auto methodStr = ZnccMethodToString(params.method);
      auto filename_suffix = to_string(params.resizeFactor) + "_" + to_string(params.winSize) + "_" + to_string(params.maxDisp) + "_" + to_string(params.ccThresh) + "_" + to_string(params.platformId) + ".png";
 
+     // The maps are moved out, result is consumed: the next run_zncc rebuilds all of them
      auto filename = "./data/" + methodStr + "_disp_" + filename_suffix;
-     saveImage(filename, result.dispMap, params.width, params.height);
+     writer.saveImage(filename, move(result.dispMap), params.width, params.height);
+
+     // The left and right maps stay on the device when it post-processes them, unless they were asked for
+     if (!result.dispMapLeft.empty())
+     {
+          filename = "./data/" + methodStr + "_left_" + filename_suffix;
+          writer.saveImage(filename, move(result.dispMapLeft), params.width, params.height);
+
+          filename = "./data/" + methodStr + "_right_" + filename_suffix;
+          writer.saveImage(filename, move(result.dispMapRight), params.width, params.height);
+     }
+
+     writer.appendLine("./data/log.csv", methodStr + "," + to_string(params.platformId) + "," + to_string(params.resizeFactor) + "," + to_string(params.winSize) + "," + to_string(params.maxDisp) + "," + to_string(params.ccThresh) + "," + to_string(params.occThresh) + "," + to_string(result.znccTime) + "," + to_string(result.postProcTime) + "\n");
+}
 
-     filename = "./data/" + methodStr + "_left_" + filename_suffix;
-     saveImage(filename, result.dispMapLeft, params.width, params.height);
 
-     filename = "./data/" + methodStr + "_right_" + filename_suffix;
-     saveImage(filename, result.dispMapRight, params.width, params.height);
+// Compare the hand-written SIMD kernels at each instruction set level against ZnccMethod::SIMD
+void run_simd_benchmark(Image &leftImg, Image &rightImg, int resizeFactor, int winSize, int maxDisp)
+{
+     auto znccParams = ZnccParams{static_cast<int>(leftImg.width) / resizeFactor, static_cast<int>(leftImg.height) / resizeFactor, maxDisp, winSize, 0, 0, resizeFactor, true, true, true, true, ZnccMethod::SIMD, 0};
+     auto baseline = run_zncc(leftImg, rightImg, znccParams);
 
-     csv_log << methodStr << "," << params.platformId << "," << params.resizeFactor << "," << params.winSize << "," << params.maxDisp << "," << params.ccThresh << "," << params.occThresh << "," << to_string(result.znccTime) << "," << to_string(result.postProcTime) << "\n";
-     csv_log.flush();
+     vector<pair<SimdIsa, long long>> timings;
+     for (auto isa : {SimdIsa::SCALAR, SimdIsa::SSE42, SimdIsa::AVX2, SimdIsa::AVX512BW})
+     {
+          if (resolveSimdIsa(isa) != isa)
+          {
+               cout << SimdIsaToString(isa) << " not supported by this CPU, skipped\n";
+               continue;
+          }
+
+          znccParams.method = ZnccMethod::SIMD_INTRINSICS;
+          znccParams.simdIsa = isa;
+          auto result = run_zncc(leftImg, rightImg, znccParams);
+          timings.push_back({isa, result.znccTime});
+     }
+
+     cout << "## SIMD benchmark (winSize " << winSize << ", maxDisp " << maxDisp << ", resizeFactor " << resizeFactor << ")\n";
+     cout << "SIMD: " << baseline.znccTime << " us\n";
+     for (auto [isa, znccTime] : timings)
+     {
+          cout << SimdIsaToString(isa) << ": " << znccTime << " us, speedup " << fixed << setprecision(2) << baseline.znccTime / static_cast<double>(znccTime) << "x\n";
+     }
 }
 
+// Stream a stereo sequence through the OpenCL device. Frames are decoded one at a time when the device asks for them,
+// each is post-processed and saved while the next ones run
+void run_opencl_stream([[maybe_unused]] const vector<StereoPairPath> &pairs, [[maybe_unused]] ZnccParams znccParams, [[maybe_unused]] const string &outDir)
+{
+#ifdef USE_OCL
+     // Grey image at resizeFactor, false when it cannot be decoded or its size differs from the stream's
+     auto loadFrame = [&](const string &path, vector<unsigned char> &img)
+     {
+          auto [err, frame] = loadImage(path, true, false);
+          if (err)
+               return false;
+          int width = static_cast<int>(frame.width) / znccParams.resizeFactor;
+          int height = static_cast<int>(frame.height) / znccParams.resizeFactor;
+          if (znccParams.width == 0)
+          {
+               znccParams.width = width;
+               znccParams.height = height;
+          }
+          else if (width != znccParams.width || height != znccParams.height)
+               return false;
+          img = znccParams.resizeFactor != 1 ? downsample(frame.dataGray, frame.width, frame.height, znccParams.resizeFactor) : move(frame.dataGray);
+          return true;
+     };
 
+     if (pairs.empty())
+     {
+          cout << "No stereo pairs to stream\n";
+          return;
+     }
+
+     // The first frame sets the size of the device buffers, so it is decoded before the stream starts
+     vector<unsigned char> firstLeft, firstRight;
+     znccParams.width = znccParams.height = 0;
+     if (!loadFrame(pairs[0].leftPath, firstLeft) || !loadFrame(pairs[0].rightPath, firstRight))
+     {
+          cout << "Cannot decode " << pairs[0].name << ", nothing to stream\n";
+          return;
+     }
+
+     size_t nextFrame = 0;
+     auto source = [&](vector<unsigned char> &leftImg, vector<unsigned char> &rightImg)
+     {
+          if (nextFrame == pairs.size())
+               return false;
+          if (nextFrame == 0)
+          {
+               leftImg = move(firstLeft);
+               rightImg = move(firstRight);
+          }
+          else if (!loadFrame(pairs[nextFrame].leftPath, leftImg) || !loadFrame(pairs[nextFrame].rightPath, rightImg))
+          {
+               cout << "Cannot decode " << pairs[nextFrame].name << " at " << znccParams.width << "x" << znccParams.height << ", the stream stops there\n";
+               return false;
+          }
+          nextFrame++;
+          return true;
+     };
+     auto sink = [&](int frameIdx, DispMap &leftDispMap, DispMap &rightDispMap)
+     {
+          ZnccResult result;
+          result.dispMapLeft = move(leftDispMap);
+          result.dispMapRight = move(rightDispMap);
+          run_post_proc(result, znccParams);
+          saveImage(outDir + "/" + pairs[frameIdx].name + "_disp.png", result.dispMap, znccParams.width, znccParams.height);
+     };
+
+     fs::create_directories(outDir);
+     cout << "Streaming " << pairs.size() << " frames through OpenCL platform " << znccParams.platformId << " into " << outDir << "\n";
+     zncc_opencl_stream(source, sink, znccParams);
+#else
+     cout << "OpenCL not enabled" << endl;
+#endif
+}
 
 int main(int argc, char **argv)
 {
@@ -72,8 +192,69 @@ int main(int argc, char **argv)
      clVecAdd();
 #endif
 
-     // Load images
-     auto [img_left, img_right] = loadImages(argc, argv);
+     // Batch mode: every stereo pair under a dataset directory, or every frame of a sequence.
+     // --opencl-stream can come anywhere after the directory, the other options keep their order
+     if (argc > 2 && string(argv[1]) == "--batch")
+     {
+          vector<string> options;
+          bool openclStream = false;
+          for (int i = 3; i < argc; i++)
+          {
+               if (string(argv[i]) == "--opencl-stream")
+                    openclStream = true;
+               else
+                    options.push_back(argv[i]);
+          }
+
+          auto pairs = findStereoPairs(argv[2]);
+          auto znccParams = ZnccParams{0, 0, 64, 9, 16, 8, 2, true, true, true, true, ZnccMethod::MULTI_THREADED, 0};
+          znccParams.fusedLeftRight = znccParams.withCrossChecking;
+          string outDir = options.size() > 0 ? options[0] : "./data/batch";
+          if (openclStream)
+          {
+               znccParams.method = ZnccMethod::OPENCL_TILED;
+               run_opencl_stream(pairs, znccParams, outDir);
+               return 0;
+          }
+          if (options.size() > 2)
+               znccParams.subPixel = options[2] == "equiangular" ? SubPixelFit::EQUIANGULAR : SubPixelFit::PARABOLA;
+          zncc_batch(pairs, znccParams, outDir, 2, options.size() > 1 ? options[1] : "png");
+          return 0;
+     }
+
+     // Strip mode: a pair too large to hold in memory, matched and written a band of rows at a time
+     if (argc > 4 && string(argv[1]) == "--strips")
+     {
+          auto znccParams = ZnccParams{0, 0, 64, 9, 16, 8, 2, true, true, true, true, ZnccMethod::INTEGRAL, 0};
+          znccParams.fusedLeftRight = znccParams.withCrossChecking;
+          size_t memoryBudget = (argc > 5 ? stoull(argv[5]) : 256) << 20;
+          return zncc_strips(argv[2], argv[3], argv[4], znccParams, memoryBudget) ? 0 : 1;
+     }
+
+     // SIMD benchmark: the intrinsics kernels at each instruction set level the CPU supports against ZnccMethod::SIMD
+     if (argc > 2 && string(argv[1]) == "--simd-benchmark")
+     {
+          string dir = argv[2];
+          if (dir.back() != '/')
+               dir += '/';
+          auto [img_left, img_right] = loadImages(dir, false);
+          run_simd_benchmark(img_left, img_right, 2, argc > 3 ? stoi(argv[3]) : 25, argc > 4 ? stoi(argv[4]) : 64);
+          return 0;
+     }
+
+     // Options after the data dir
+     bool cacheTiling = false;
+     bool boundedSearch = false;
+     for (int i = 2; i < argc; i++)
+     {
+          if (string(argv[i]) == "--cache-tiling")
+               cacheTiling = true;
+          else if (string(argv[i]) == "--bounded-search")
+               boundedSearch = true;
+     }
+
+     // Load images, the matcher only reads the grey ones so the RGBA buffers are not kept
+     auto [img_left, img_right] = loadImages(argc, argv, false);
      cout << "Left image stats:\n"
           << "\tDims: " << img_left.width << "x" << img_left.height << "\n"
           << "\tRGB size: " << img_left.dataRgb.size() << "\n"
@@ -83,15 +264,23 @@ int main(int argc, char **argv)
           << "\tRGB size: " << img_right.dataRgb.size() << "\n"
           << "\tGray size: " << img_right.dataGray.size() << "\n";
 
-     ofstream csv_log;
-     csv_log.open("./data/log.csv", ios::out | ios::app);
+     {
+          ofstream csv_log;
+          csv_log.open("./data/log.csv", ios::out | ios::app);
+
+          if(filesystem::is_empty("./data/log.csv"))
+               csv_log << "method,platformId,resizeFactor,winSize,maxDisp,ccThresh,occThresh,znccTime,postprocTime\n";
+     }
 
-     if(filesystem::is_empty("./data/log.csv"))
-          csv_log << "method,platformId,resizeFactor,winSize,maxDisp,ccThresh,occThresh,znccTime,postprocTime\n";
+     // Outputs are encoded on two background threads with fast deflate, 0 would store them uncompressed
+     AsyncWriter writer(2, 8, 1);
 
      // Run Grid Search for ZNCC Params
      // for (auto method : {ZnccMethod::MULTI_THREADED, ZnccMethod::OPENMP, ZnccMethod::SIMD, ZnccMethod::OPENCL, ZnccMethod::CUDA})
-     for (auto method : {ZnccMethod::OPENCL})//, ZnccMethod::OPENCL, ZnccMethod::SIMD, ZnccMethod::MULTI_THREADED})
+     vector<ZnccMethod> methods{ZnccMethod::OPENCL};//, ZnccMethod::OPENCL, ZnccMethod::SIMD, ZnccMethod::MULTI_THREADED}
+     if (boundedSearch && find(methods.begin(), methods.end(), ZnccMethod::INTEGRAL) == methods.end())
+          methods.push_back(ZnccMethod::INTEGRAL);
+     for (auto method : methods)
      {
           for (auto platformId : {1})
           {
@@ -102,6 +291,10 @@ int main(int argc, char **argv)
                          for (auto maxDisp : {32, 64, 128})
                          {
                               auto znccParams = ZnccParams{static_cast<int>(img_left.width) / resizeFactor, static_cast<int>(img_left.height) / resizeFactor, maxDisp, winSize, 0, 0, resizeFactor, true, true, true, true, method, platformId};
+                              // the bound only exists in the two-pass INTEGRAL kernel
+                              znccParams.boundedSearch = boundedSearch && method == ZnccMethod::INTEGRAL;
+                              znccParams.fusedLeftRight = znccParams.withCrossChecking && !znccParams.boundedSearch;
+                              znccParams.cacheTiling = cacheTiling;
                               auto result = run_zncc(img_left, img_right, znccParams);
                               for (auto ccThresh : {maxDisp / 4})
                               {
@@ -110,7 +303,7 @@ int main(int argc, char **argv)
                                         znccParams.ccThresh = ccThresh;
                                         znccParams.occThresh = occThresh;
                                         run_post_proc(result, znccParams);
-                                        run_logger(result, znccParams, csv_log);
+                                        run_logger(result, znccParams, writer);
                                    }
                               }
                          }
@@ -119,7 +312,17 @@ int main(int argc, char **argv)
           }
      }
 
-     csv_log.close();
+     writer.flush();
+     writer.printStats();
+
+#ifdef USE_OCL
+     printOpenclCacheStats();
+#endif
+
+     // Totals of the INTEGRAL runs with znccParams.boundedSearch
+     auto boundedStats = getBoundedSearchStats();
+     if (boundedStats.candidates > 0)
+          printBoundedSearchStats(boundedStats);
 
      // ZNCC best params
      // auto resizeFactor = 1;
@@ -0,0 +1,129 @@
+#include "async_writer.hpp"
+
+AsyncWriter::AsyncWriter(int numThreads, size_t maxPending, int compressionLevel) : maxPending(max<size_t>(1, maxPending)), compressionLevel(compressionLevel)
+{
+    for (int t = 0; t < max(1, numThreads); t++)
+    {
+        workers.emplace_back(&AsyncWriter::workerLoop, this);
+    }
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    notEmpty.notify_all();
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void AsyncWriter::saveImage(string fpath, vector<unsigned char> &&img, int w, int h)
+{
+    WriteTask task;
+    task.fpath = move(fpath);
+    task.img = move(img);
+    task.width = w;
+    task.height = h;
+    push(move(task));
+}
+
+void AsyncWriter::saveImage(string fpath, vector<uint16_t> &&img, int w, int h)
+{
+    WriteTask task;
+    task.kind = TaskKind::IMAGE16;
+    task.fpath = move(fpath);
+    task.img16 = move(img);
+    task.width = w;
+    task.height = h;
+    push(move(task));
+}
+
+void AsyncWriter::appendLine(string fpath, string line)
+{
+    WriteTask task;
+    task.kind = TaskKind::LOG_LINE;
+    task.fpath = move(fpath);
+    task.line = move(line);
+    push(move(task));
+}
+
+void AsyncWriter::push(WriteTask task)
+{
+    unique_lock<mutex> lock(m);
+    if (tasks.size() >= maxPending)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        notFull.wait(lock, [&]() { return tasks.size() < maxPending; });
+        blockedUs += chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count();
+    }
+
+    tasks.push_back(move(task));
+    notEmpty.notify_one();
+}
+
+void AsyncWriter::flush()
+{
+    unique_lock<mutex> lock(m);
+    idle.wait(lock, [&]() { return tasks.empty() && running == 0; });
+
+    for (auto &[fpath, log] : logs)
+    {
+        log.flush();
+    }
+}
+
+void AsyncWriter::workerLoop()
+{
+    unique_lock<mutex> lock(m);
+
+    while (true)
+    {
+        notEmpty.wait(lock, [&]() { return stopping || !tasks.empty(); });
+        if (tasks.empty())
+            break;
+
+        WriteTask task = move(tasks.front());
+        tasks.pop_front();
+        notFull.notify_one();
+
+        // Log lines are short, writing them under the lock keeps each file in push order
+        if (task.kind == TaskKind::LOG_LINE)
+        {
+            auto &log = logs[task.fpath];
+            if (!log.is_open())
+                log.open(task.fpath, ios::out | ios::app);
+            log << task.line;
+        }
+        else
+        {
+            running++;
+            lock.unlock();
+
+            auto start = chrono::high_resolution_clock::now();
+            if (task.kind == TaskKind::IMAGE)
+                ::saveImage(task.fpath, task.img, task.width, task.height, compressionLevel);
+            else
+                ::saveImage(task.fpath, task.img16, task.width, task.height, compressionLevel);
+            auto elapsedUs = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count();
+
+            lock.lock();
+            running--;
+            imagesWritten++;
+            encodeUs += elapsedUs;
+        }
+
+        if (tasks.empty() && running == 0)
+            idle.notify_all();
+    }
+}
+
+void AsyncWriter::printStats()
+{
+    lock_guard<mutex> lock(m);
+    cout << "# Async writer: " << imagesWritten << " images on " << workers.size() << " threads, " << encodeUs << " us encoding, callers blocked " << blockedUs << " us" << endl;
+}
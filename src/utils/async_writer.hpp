@@ -0,0 +1,75 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "datatools.hpp"
+
+using namespace std;
+
+// Writes images and log lines on a few background threads, off the compute thread. Images are moved in, so the
+// caller keeps no copy, and are PNG-encoded at compressionLevel (see saveImage, 0 is store-only). At most
+// maxPending writes wait in the queue, beyond that the caller blocks until a worker catches up.
+class AsyncWriter
+{
+public:
+    AsyncWriter(int numThreads = 2, size_t maxPending = 8, int compressionLevel = -1);
+    ~AsyncWriter(); // waits for the pending writes
+
+    void saveImage(string fpath, vector<unsigned char> &&img, int w, int h);
+    void saveImage(string fpath, vector<uint16_t> &&img, int w, int h);
+
+    // Lines of a log file are appended in the order they are pushed
+    void appendLine(string fpath, string line);
+
+    // Waits until every write pushed so far is done, and the log files are flushed
+    void flush();
+
+    void printStats();
+
+private:
+    enum class TaskKind
+    {
+        IMAGE,
+        IMAGE16,
+        LOG_LINE
+    };
+
+    struct WriteTask
+    {
+        TaskKind kind = TaskKind::IMAGE;
+        string fpath;
+        vector<unsigned char> img;
+        vector<uint16_t> img16;
+        int width = 0;
+        int height = 0;
+        string line;
+    };
+
+    void push(WriteTask task);
+    void workerLoop();
+
+    const size_t maxPending;
+    const int compressionLevel;
+    vector<thread> workers;
+    mutex m;
+    condition_variable notEmpty;
+    condition_variable notFull;
+    condition_variable idle;
+    deque<WriteTask> tasks;
+    map<string, ofstream> logs;
+    int running = 0;
+    bool stopping = false;
+
+    // Stats
+    int imagesWritten = 0;
+    long long encodeUs = 0;
+    long long blockedUs = 0; // time callers spent waiting on a full queue
+};
@@ -108,7 +108,7 @@ int clHelloWorld()
 
         
     }
-    catch (cl::Error error)
+    catch (const cl::Error &error)
     {
         cout << error.what() << ": " << get_cl_err(error.err()) << endl;
     }
@@ -186,7 +186,7 @@ int clVecAdd()
         // Copy the output data back to the host
         queue.enqueueReadBuffer(bufferC, CL_TRUE, 0, datasize, C);
     }
-    catch (cl::Error error)
+    catch (const cl::Error &error)
     {
         cout << error.what() << ": " << get_cl_err(error.err()) << endl;
     }
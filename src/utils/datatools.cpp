@@ -1,19 +1,99 @@
 #include "datatools.hpp"
 
-vector<unsigned char> rgbaToGray(const vector<unsigned char> &rgbImg, int w, int h)
+// Luma weights 0.2126, 0.7152 and 0.0722 in 16-bit fixed point, they add up to 1 << 16 so white stays 255
+constexpr uint32_t grayWeightR = 13933;
+constexpr uint32_t grayWeightG = 46871;
+constexpr uint32_t grayWeightB = 4732;
+
+void rgbaRowToGray(const unsigned char *rgbaRow, unsigned char *grayRow, int width)
 {
-    vector<unsigned char> grayImg(w * h);
+    // Constant stride, so the compiler can de-interleave the channels with vector shuffles
+#ifdef USE_SIMD
+#pragma omp simd
+#endif
+    for (int x = 0; x < width; x++)
+        grayRow[x] = static_cast<unsigned char>((rgbaRow[4 * x] * grayWeightR + rgbaRow[4 * x + 1] * grayWeightG + rgbaRow[4 * x + 2] * grayWeightB) >> 16);
+}
 
-    for (int i = 0; i < w * h; ++i)
+// Adds a row of factor * outWidth pixels to the column sums of the factor x factor blocks being averaged
+void accumulateRow(const unsigned char *row, uint32_t *colSum, int n)
+{
+#ifdef USE_SIMD
+#pragma omp simd
+#endif
+    for (int x = 0; x < n; x++)
+        colSum[x] += row[x];
+}
+
+// Rounded averages of factor consecutive column sums, the factor rows below each output pixel. The division by
+// the area is a multiply by its 32-bit reciprocal, exact for the sums of 8-bit pixels up to factor 63.
+void averageBlocks(const uint32_t *colSum, unsigned char *out, int outWidth, int factor)
+{
+    const uint32_t area = factor * factor;
+    if (factor == 2)
     {
-        const int rgbIdx = i * 4;
-        const double r = rgbImg[rgbIdx] * 0.2126;
-        const double g = rgbImg[rgbIdx + 1] * 0.7152;
-        const double b = rgbImg[rgbIdx + 2] * 0.0722;
+        // the common case, unrolled so that it vectorises without gathers
+#ifdef USE_SIMD
+#pragma omp simd
+#endif
+        for (int x = 0; x < outWidth; x++)
+            out[x] = static_cast<unsigned char>((colSum[2 * x] + colSum[2 * x + 1] + 2) >> 2);
+        return;
+    }
 
-        grayImg[i] = static_cast<unsigned char>(r + g + b);
+    const uint64_t reciprocal = ((1ull << 32) + area - 1) / area;
+#ifdef USE_SIMD
+#pragma omp simd
+#endif
+    for (int x = 0; x < outWidth; x++)
+    {
+        uint32_t sum = 0;
+        for (int i = 0; i < factor; i++)
+            sum += colSum[x * factor + i];
+        out[x] = static_cast<unsigned char>(((sum + area / 2) * reciprocal) >> 32);
     }
+}
+
+// Rows of rgba to grey, averaged over factor x factor blocks into a width / factor x height / factor image
+void rgbaToGray(const unsigned char *rgba, unsigned char *gray, int w, int h, int factor)
+{
+    const int outWidth = w / factor;
+    const int outHeight = h / factor;
+
+    ThreadPool::getInstance().parallelFor(0, outHeight, [&](int y0, int y1)
+                                          {
+        vector<unsigned char> grayRow(factor > 1 ? w : 0);
+        vector<uint32_t> colSum(factor > 1 ? outWidth * factor : 0);
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char *rgbaRow = rgba + static_cast<size_t>(y) * factor * w * 4;
+            if (factor == 1)
+            {
+                rgbaRowToGray(rgbaRow, gray + static_cast<size_t>(y) * outWidth, outWidth);
+                continue;
+            }
+
+            fill(colSum.begin(), colSum.end(), 0);
+            for (int dy = 0; dy < factor; dy++)
+            {
+                rgbaRowToGray(rgbaRow + static_cast<size_t>(dy) * w * 4, grayRow.data(), outWidth * factor);
+                accumulateRow(grayRow.data(), colSum.data(), outWidth * factor);
+            }
+            averageBlocks(colSum.data(), gray + static_cast<size_t>(y) * outWidth, outWidth, factor);
+        } });
+}
+
+vector<unsigned char> rgbaToGray(const vector<unsigned char> &rgbImg, int w, int h)
+{
+    vector<unsigned char> grayImg(static_cast<size_t>(w) * h);
+    rgbaToGray(rgbImg.data(), grayImg.data(), w, h, 1);
+    return grayImg;
+}
 
+vector<unsigned char> rgbaToGrayDownsample(const vector<unsigned char> &rgbImg, int w, int h, int factor)
+{
+    vector<unsigned char> grayImg(static_cast<size_t>(w / factor) * (h / factor));
+    rgbaToGray(rgbImg.data(), grayImg.data(), w, h, factor);
     return grayImg;
 }
 
@@ -43,37 +123,128 @@ vector<unsigned char> downsample(const vector<unsigned char> &image, int width,
     int new_width = width / factor;
     int new_height = height / factor;
 
+    // 2x2 blocks are summed directly, without the column sums. buildPyramid has no level 1 for images under 2x2,
+    // those take the path below and come out empty
+    if (factor == 2 && width >= 2 && height >= 2)
+        return move(buildPyramid(image, width, height, 2)[1]);
+
     vector<unsigned char> resized_image(new_width * new_height);
 
-    for (int y = 0; y < new_height; y++)
-    {
-        for (int x = 0; x < new_width; x++)
+    ThreadPool::getInstance().parallelFor(0, new_height, [&](int y0, int y1)
+                                          {
+        vector<uint32_t> colSum(new_width * factor);
+        for (int y = y0; y < y1; y++)
         {
-            // Compute the corresponding pixel in the original image
-            int x_orig = x * factor;
-            int y_orig = y * factor;
-
-            // Compute the four nearest neighbors in the original image
-            unsigned char tl = image[y_orig * width + x_orig];
-            unsigned char tr = image[y_orig * width + x_orig + 1];
-            unsigned char bl = image[(y_orig + 1) * width + x_orig];
-            unsigned char br = image[(y_orig + 1) * width + x_orig + 1];
-
-            // Compute the weighted average using bilinear interpolation
-            float x_ratio = static_cast<float>(x_orig % factor) / (float)factor;
-            float y_ratio = static_cast<float>(y_orig % factor) / (float)factor;
-            float top = tl * (1.0f - x_ratio) + tr * x_ratio;
-            float bottom = bl * (1.0f - x_ratio) + br * x_ratio;
-            float value = top * (1.0f - y_ratio) + bottom * y_ratio;
-
-            // Store the result in the resized image
-            resized_image[y * new_width + x] = static_cast<unsigned char>(value);
-        }
-    }
+            // Box filter over the factor x factor pixels each output pixel covers, so larger factors do not alias
+            fill(colSum.begin(), colSum.end(), 0);
+            for (int dy = 0; dy < factor; dy++)
+                accumulateRow(&image[(y * factor + dy) * width], colSum.data(), new_width * factor);
+            averageBlocks(colSum.data(), &resized_image[y * new_width], new_width, factor);
+        } });
 
     return resized_image;
 }
 
+// 2x2 block sums of two rows of the level below, kept in sums when a coarser level needs them, and rounded into
+// level k
+template <typename T>
+void sumBlocks2x2(const T *top, const T *bottom, uint32_t *sums, unsigned char *level, int w, int k)
+{
+    const uint32_t half = 1u << (2 * k - 1);
+    if (!sums)
+    {
+#ifdef USE_SIMD
+#pragma omp simd
+#endif
+        for (int x = 0; x < w; x++)
+            level[x] = static_cast<unsigned char>((top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + half) >> (2 * k));
+        return;
+    }
+
+#ifdef USE_SIMD
+#pragma omp simd
+#endif
+    for (int x = 0; x < w; x++)
+    {
+        const uint32_t sum = top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1];
+        sums[x] = sum;
+        level[x] = static_cast<unsigned char>((sum + half) >> (2 * k));
+    }
+}
+
+vector<vector<unsigned char>> buildPyramid(const vector<unsigned char> &image, int width, int height, int numLevels)
+{
+    vector<vector<unsigned char>> levels(1);
+    vector<int> widths{width};
+    vector<int> heights{height};
+
+    // The 4^k * 255 sums of level k fit 32 bits up to level 11
+    for (int k = 1; k < min(numLevels, 12) && widths.back() >= 2 && heights.back() >= 2; k++)
+    {
+        widths.push_back(widths.back() / 2);
+        heights.push_back(heights.back() / 2);
+        levels.emplace_back(static_cast<size_t>(widths.back()) * heights.back());
+    }
+
+    // Each level sums 2x2 blocks of the unrounded sums of the one below, so level k is rounded once and equals
+    // downsample(image, 2^k), while the source image is read only once
+    vector<uint32_t> sums;
+    for (int k = 1; k < static_cast<int>(levels.size()); k++)
+    {
+        const int w = widths[k];
+        const int prevWidth = widths[k - 1];
+        const bool last = k + 1 == static_cast<int>(levels.size());
+        vector<uint32_t> coarserSums(last ? 0 : static_cast<size_t>(w) * heights[k]);
+
+        ThreadPool::getInstance().parallelFor(0, heights[k], [&](int y0, int y1)
+                                              {
+            for (int y = y0; y < y1; y++)
+            {
+                uint32_t *out = last ? nullptr : &coarserSums[static_cast<size_t>(y) * w];
+                unsigned char *level = &levels[k][static_cast<size_t>(y) * w];
+                if (k == 1)
+                {
+                    const unsigned char *top = &image[static_cast<size_t>(2 * y) * prevWidth];
+                    sumBlocks2x2(top, top + prevWidth, out, level, w, k);
+                }
+                else
+                {
+                    const uint32_t *top = &sums[static_cast<size_t>(2 * y) * prevWidth];
+                    sumBlocks2x2(top, top + prevWidth, out, level, w, k);
+                }
+            } });
+
+        sums = move(coarserSums);
+    }
+
+    return levels;
+}
+
+const vector<unsigned char> &grayLevel(Image &img, int factor)
+{
+    if (factor == 1)
+        return img.dataGray;
+
+    auto cached = img.grayLevels.find(factor);
+    if (cached != img.grayLevels.end())
+        return cached->second;
+
+    if ((factor & (factor - 1)) == 0)
+    {
+        // Powers of two come out of one pyramid build, which also caches the levels below
+        int numLevels = 1;
+        while ((1 << (numLevels - 1)) < factor)
+            numLevels++;
+        auto levels = buildPyramid(img.dataGray, img.width, img.height, numLevels);
+        for (int k = 1; k < static_cast<int>(levels.size()); k++)
+            img.grayLevels[1 << k] = move(levels[k]);
+    }
+    if (!img.grayLevels.count(factor))
+        img.grayLevels[factor] = downsample(img.dataGray, img.width, img.height, factor);
+
+    return img.grayLevels[factor];
+}
+
 vector<unsigned char> upsample(const vector<unsigned char> &img, int width, int height, int factor)
 {
     int new_width = width * factor;
@@ -95,8 +266,89 @@ vector<unsigned char> upsample(const vector<unsigned char> &img, int width, int
     return new_img;
 }
 
-tuple<bool, Image> loadImage(string fpath)
+// Next number of a PGM header, skipping whitespace and # comments
+bool readPgmNumber(const unsigned char *data, size_t size, size_t &pos, unsigned &value)
+{
+    while (pos < size && (isspace(data[pos]) || data[pos] == '#'))
+    {
+        if (data[pos] == '#')
+            while (pos < size && data[pos] != '\n')
+                pos++;
+        else
+            pos++;
+    }
+    if (pos >= size || !isdigit(data[pos]))
+        return false;
+
+    value = 0;
+    while (pos < size && isdigit(data[pos]))
+        value = value * 10 + (data[pos++] - '0');
+    return true;
+}
+
+bool openGrayImage(string fpath, MappedGrayImage &img)
+{
+    img.file = make_unique<MappedFile>(fpath);
+    if (!img.file->valid())
+    {
+        printf("error mapping %s\n", fpath.c_str());
+        return false;
+    }
+
+    const unsigned char *data = img.file->data();
+    size_t offset = 0;
+    bool valid = false;
+    if (filesystem::path(fpath).extension() == ".raw")
+    {
+        RawHeader header;
+        if (img.file->size() >= sizeof(header))
+        {
+            memcpy(&header, data, sizeof(header));
+            valid = memcmp(header.magic, "ZRAW", 4) == 0 && header.type == RawType::UINT8;
+            img.width = header.width;
+            img.height = header.height;
+            offset = sizeof(header);
+        }
+    }
+    else
+    {
+        unsigned maxVal = 0;
+        valid = img.file->size() > 2 && data[0] == 'P' && data[1] == '5';
+        offset = 2;
+        valid = valid && readPgmNumber(data, img.file->size(), offset, img.width) && readPgmNumber(data, img.file->size(), offset, img.height) && readPgmNumber(data, img.file->size(), offset, maxVal) && maxVal <= 255;
+        offset++; // single whitespace before the pixels
+    }
+
+    const size_t numPixels = static_cast<size_t>(img.width) * img.height;
+    if (!valid || offset + numPixels > img.file->size())
+    {
+        printf("error for %s: not an 8-bit PGM or uint8 raw image\n", fpath.c_str());
+        return false;
+    }
+
+    img.pixels = data + offset;
+    return true;
+}
+
+tuple<bool, Image> loadGrayImage(string fpath)
+{
+    MappedGrayImage mapped;
+    if (!openGrayImage(fpath, mapped))
+        return make_tuple(true, Image{});
+
+    Image img{};
+    img.width = mapped.width;
+    img.height = mapped.height;
+    img.dataGray.assign(mapped.pixels, mapped.pixels + static_cast<size_t>(img.width) * img.height);
+    return make_tuple(false, img);
+}
+
+tuple<bool, Image> loadImage(string fpath, bool withGray, bool keepRgb)
 {
+    auto extension = filesystem::path(fpath).extension();
+    if (extension == ".pgm" || extension == ".raw")
+        return loadGrayImage(fpath);
+
     unsigned error;
     unsigned char *buffer;
     Image img;
@@ -106,8 +358,14 @@ tuple<bool, Image> loadImage(string fpath)
         printf("error %u for %s: %s\n", error, fpath.c_str(), lodepng_error_text(error));
     else
     {
-        img.dataRgb = vector<unsigned char>(buffer, buffer + img.width * img.height * 4);
-        img.dataGray = rgbaToGray(img.dataRgb, img.width, img.height);
+        // Without keepRgb the grey image is converted straight from the decoder's buffer, no RGBA copy is made
+        if (keepRgb)
+            img.dataRgb = vector<unsigned char>(buffer, buffer + img.width * img.height * 4);
+        if (withGray || !keepRgb)
+        {
+            img.dataGray.resize(static_cast<size_t>(img.width) * img.height);
+            rgbaToGray(buffer, img.dataGray.data(), img.width, img.height, 1);
+        }
         // img.dataGraySmall = downsample(img.dataGray, img.width, img.height);
         // img.widthSmall = img.width / factor;
         // img.heightSmall = img.height / factor;
@@ -118,33 +376,36 @@ tuple<bool, Image> loadImage(string fpath)
     return make_tuple(error, img);
 }
 
-tuple<bool, Image> loadImage(string dir, string fname)
+tuple<bool, Image> loadImage(string dir, string fname, bool keepRgb)
 {
     string path = dir + fname;
-    return loadImage(path);
+    return loadImage(path, true, keepRgb);
 }
 
-tuple<Image, Image> loadImages(string dir, string fname_0, string fname_1)
+tuple<Image, Image> loadImages(string dir, string fname_0, string fname_1, bool keepRgb)
 {
     unsigned err;
     Image img_left;
     Image img_right;
 
-    tie(err, img_left) = loadImage(dir, fname_0);
+    tie(err, img_left) = loadImage(dir, fname_0, keepRgb);
     if (!err)
-        tie(err, img_right) = loadImage(dir, fname_1);
+        tie(err, img_right) = loadImage(dir, fname_1, keepRgb);
 
     return make_tuple(img_left, img_right);
 }
 
-tuple<Image, Image> loadImages(string dir)
+tuple<Image, Image> loadImages(string dir, bool keepRgb)
 {
-    return loadImages(dir, "im0.png", "im1.png");
+    // grey captures come as PGM
+    if (!filesystem::exists(dir + "im0.png") && filesystem::exists(dir + "im0.pgm"))
+        return loadImages(dir, "im0.pgm", "im1.pgm");
+    return loadImages(dir, "im0.png", "im1.png", keepRgb);
 }
 
-tuple<Image, Image> loadImages(int argc, char **argv)
+tuple<Image, Image> loadImages(int argc, char **argv, bool keepRgb)
 {
-    return argc > 1 ? loadImages(argv[1]) : loadImages();
+    return loadImages(argc > 1 ? argv[1] : "./data/2019_backpack/", keepRgb);
 }
 
 tuple<Image, Image> loadImages()
@@ -153,17 +414,186 @@ tuple<Image, Image> loadImages()
     return loadImages(dir);
 }
 
-void saveImage(string fpath, const vector<unsigned char> &img, int w, int h)
+// 16-bit images are passed as big-endian byte pairs
+unsigned encodeImage(string fpath, const vector<unsigned char> &img, int w, int h, LodePNGColorType colorType, int compressionLevel, unsigned bitDepth = 8)
+{
+    if (compressionLevel < 0)
+        return lodepng_encode_file(fpath.c_str(), img.data(), w, h, colorType, bitDepth);
+
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = colorType;
+    state.info_raw.bitdepth = bitDepth;
+
+    auto &zlib = state.encoder.zlibsettings;
+    if (compressionLevel == 0)
+    {
+        zlib.btype = 0;
+        state.encoder.filter_strategy = LFS_ZERO;
+    }
+    else
+    {
+        zlib.btype = 2;
+        zlib.use_lz77 = 1;
+        zlib.windowsize = min(32768u, 256u << (compressionLevel - 1));
+        zlib.lazymatching = compressionLevel >= 4;
+        state.encoder.filter_strategy = compressionLevel >= 4 ? LFS_MINSUM : LFS_ZERO;
+    }
+
+    unsigned char *png = nullptr;
+    size_t pngSize = 0;
+    unsigned error = lodepng_encode(&png, &pngSize, img.data(), w, h, &state);
+    if (!error)
+        error = lodepng_save_file(png, pngSize, fpath.c_str());
+
+    free(png);
+    lodepng_state_cleanup(&state);
+    return error;
+}
+
+template <typename T>
+void saveRaw(string fpath, const vector<T> &map, int w, int h, RawType type)
+{
+    const size_t dataSize = map.size() * sizeof(T);
+    MappedFile file(fpath, sizeof(RawHeader) + dataSize);
+    if (!file.valid())
+    {
+        printf("error writing %s\n", fpath.c_str());
+        return;
+    }
+
+    RawHeader header{{'Z', 'R', 'A', 'W'}, static_cast<uint32_t>(w), static_cast<uint32_t>(h), type};
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + sizeof(header), map.data(), dataSize);
+}
+
+void saveDisparityRaw(string fpath, const vector<unsigned char> &map, int w, int h)
+{
+    saveRaw(fpath, map, w, h, RawType::UINT8);
+}
+
+void saveDisparityRaw(string fpath, const vector<uint16_t> &map, int w, int h)
+{
+    saveRaw(fpath, map, w, h, RawType::UINT16);
+}
+
+void saveDisparityRaw(string fpath, const vector<float> &map, int w, int h)
 {
+    saveRaw(fpath, map, w, h, RawType::FLOAT32);
+}
+
+void savePgm(string fpath, const vector<unsigned char> &img, int w, int h, int maxVal = 255)
+{
+    const string header = "P5\n" + to_string(w) + " " + to_string(h) + "\n" + to_string(maxVal) + "\n";
+    MappedFile file(fpath, header.size() + img.size());
+    if (!file.valid())
+    {
+        printf("error writing %s\n", fpath.c_str());
+        return;
+    }
+
+    memcpy(file.data(), header.data(), header.size());
+    memcpy(file.data() + header.size(), img.data(), img.size());
+}
+
+void saveImage(string fpath, const vector<unsigned char> &img, int w, int h, int compressionLevel)
+{
+    auto extension = filesystem::path(fpath).extension();
+    if (img.size() == static_cast<size_t>(w) * h && (extension == ".raw" || extension == ".pgm"))
+    {
+        extension == ".raw" ? saveDisparityRaw(fpath, img, w, h) : savePgm(fpath, img, w, h);
+        return;
+    }
+
     unsigned error;
 
     if (img.size() == w * h)
-        error = lodepng_encode_file(fpath.c_str(), img.data(), w, h, LCT_GREY, 8);
+        error = encodeImage(fpath, img, w, h, LCT_GREY, compressionLevel);
     else if (img.size() == w * h * 3)
-        error = lodepng_encode_file(fpath.c_str(), img.data(), w, h, LCT_RGB, 8);
+        error = encodeImage(fpath, img, w, h, LCT_RGB, compressionLevel);
     else if (img.size() == w * h * 4)
-        error = lodepng_encode_file(fpath.c_str(), img.data(), w, h, LCT_RGBA, 8);
+        error = encodeImage(fpath, img, w, h, LCT_RGBA, compressionLevel);
+
+    if (error)
+        printf("error %u for %s: %s\n", error, fpath.c_str(), lodepng_error_text(error));
+}
+
+void saveImage(string fpath, const vector<uint16_t> &img, int w, int h, int compressionLevel)
+{
+    auto extension = filesystem::path(fpath).extension();
+    if (extension == ".raw")
+    {
+        saveDisparityRaw(fpath, img, w, h);
+        return;
+    }
 
+    // PNG and PGM both store 16-bit samples big-endian
+    vector<unsigned char> bytes(img.size() * 2);
+    for (size_t i = 0; i < img.size(); i++)
+    {
+        bytes[2 * i] = static_cast<unsigned char>(img[i] >> 8);
+        bytes[2 * i + 1] = static_cast<unsigned char>(img[i]);
+    }
+
+    if (extension == ".pgm")
+    {
+        savePgm(fpath, bytes, w, h, 65535);
+        return;
+    }
+
+    unsigned error = encodeImage(fpath, bytes, w, h, LCT_GREY, compressionLevel, 16);
     if (error)
         printf("error %u for %s: %s\n", error, fpath.c_str(), lodepng_error_text(error));
+}
+
+GrayImageWriter::GrayImageWriter(string fpath, int w, int h, int bitDepth) : width(w), bitDepth(bitDepth)
+{
+    const bool raw = filesystem::path(fpath).extension() == ".raw";
+    string header;
+    if (raw)
+    {
+        RawHeader rawHeader{{'Z', 'R', 'A', 'W'}, static_cast<uint32_t>(w), static_cast<uint32_t>(h), bitDepth == 16 ? RawType::UINT16 : RawType::UINT8};
+        header.assign(reinterpret_cast<const char *>(&rawHeader), sizeof(rawHeader));
+    }
+    else
+    {
+        header = "P5\n" + to_string(w) + " " + to_string(h) + "\n" + to_string((1 << bitDepth) - 1) + "\n";
+    }
+    bigEndian = !raw && bitDepth == 16;
+    offset = header.size();
+
+    file = make_unique<MappedFile>(fpath, offset + static_cast<size_t>(w) * h * (bitDepth / 8));
+    if (!file->valid())
+    {
+        printf("error writing %s\n", fpath.c_str());
+        return;
+    }
+    memcpy(file->data(), header.data(), header.size());
+}
+
+void GrayImageWriter::writeRows(int y, const unsigned char *rows, int numRows)
+{
+    const size_t start = offset + static_cast<size_t>(y) * width;
+    memcpy(file->data() + start, rows, static_cast<size_t>(numRows) * width);
+    file->release(start, static_cast<size_t>(numRows) * width);
+}
+
+void GrayImageWriter::writeRows(int y, const uint16_t *rows, int numRows)
+{
+    const size_t start = offset + static_cast<size_t>(y) * width * 2;
+    unsigned char *out = file->data() + start;
+    const size_t count = static_cast<size_t>(numRows) * width;
+    if (!bigEndian)
+    {
+        memcpy(out, rows, count * 2);
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            out[2 * i] = static_cast<unsigned char>(rows[i] >> 8);
+            out[2 * i + 1] = static_cast<unsigned char>(rows[i]);
+        }
+    }
+    file->release(start, count * 2);
 }
\ No newline at end of file
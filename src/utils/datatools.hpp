@@ -3,6 +3,14 @@
 #include <lodepng.h>
 #include <tuple>
 #include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include "thread_pool.hpp"
+#include "mapped_file.hpp"
 
 using namespace std;
 
@@ -12,17 +20,98 @@ struct Image
     unsigned int height;
     vector<unsigned char> dataRgb;
     vector<unsigned char> dataGray;
+    map<int, vector<unsigned char>> grayLevels; // dataGray downsampled by each factor used so far, see grayLevel
 };
 
+// Header of the .raw grey images and disparity maps, followed by width * height values in host byte order
+enum class RawType : uint32_t
+{
+    UINT8,
+    UINT16,
+    FLOAT32
+};
+
+struct RawHeader
+{
+    char magic[4]; // "ZRAW"
+    uint32_t width;
+    uint32_t height;
+    RawType type;
+};
+
+// Fixed-point luma conversion, vectorised along rows and spread over the thread pool
 vector<unsigned char> rgbaToGray(const vector<unsigned char>& rgbImg, int w, int h);
-tuple<bool, Image> loadImage(string fpath);
-tuple<bool, Image> loadImage(string dir, string fname);
-tuple<Image, Image> loadImages(string dir, string fname_0, string fname_1);
-tuple<Image, Image> loadImages(string dir);
+void rgbaToGray(const unsigned char *rgba, unsigned char *gray, int w, int h, int factor);
+
+// rgbaToGray fused with downsample, each row is converted and box-averaged in one pass
+vector<unsigned char> rgbaToGrayDownsample(const vector<unsigned char> &rgbImg, int w, int h, int factor);
+
+// withGray false leaves dataGray empty, for callers converting it later. keepRgb false never keeps the RGBA
+// buffer and always converts dataGray. .pgm and .raw files go to loadGrayImage.
+tuple<bool, Image> loadImage(string fpath, bool withGray = true, bool keepRgb = true);
+
+// 8-bit PGM (P5) or uint8 .raw image left in its memory mapping, rows are read from pixels as they are needed
+struct MappedGrayImage
+{
+    unique_ptr<MappedFile> file;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    const unsigned char *pixels = nullptr;
+};
+
+// False, with a message, when fpath cannot be mapped or is not an 8-bit PGM or uint8 raw image
+bool openGrayImage(string fpath, MappedGrayImage &img);
+
+// 8-bit PGM (P5) or uint8 .raw image read through a memory mapping straight into dataGray, dataRgb stays empty
+tuple<bool, Image> loadGrayImage(string fpath);
+tuple<bool, Image> loadImage(string dir, string fname, bool keepRgb = true);
+tuple<Image, Image> loadImages(string dir, string fname_0, string fname_1, bool keepRgb = true);
+tuple<Image, Image> loadImages(string dir, bool keepRgb = true);
 tuple<Image, Image> loadImages();
-tuple<Image, Image> loadImages(int argv, char **argc);
+tuple<Image, Image> loadImages(int argv, char **argc, bool keepRgb = true);
 
+// Box average over the factor x factor pixels of each output pixel, width / factor x height / factor
 vector<unsigned char> downsample(const vector<unsigned char> &image, int width, int height, int factor);
+
+// Levels 1 to numLevels - 1 at the same indices, each half the size of the one before and equal to
+// downsample(image, width, height, 2^k). Level 0 is image itself and left empty. Stops early once a level would
+// drop below 1x1.
+vector<vector<unsigned char>> buildPyramid(const vector<unsigned char> &image, int width, int height, int numLevels);
+
+// dataGray downsampled by factor, computed on first use and cached in the image, not thread-safe
+const vector<unsigned char> &grayLevel(Image &img, int factor);
 vector<unsigned char> upsample(const vector<unsigned char> &img, int width, int height, int factor);
 
-void saveImage(string fpath, const vector<unsigned char>& img, int w, int h);
\ No newline at end of file
+// compressionLevel -1 keeps the lodepng defaults, 0 stores the image data uncompressed and 1 to 9 trade
+// speed for size, from a small deflate window without filtering up to the largest window with lazy matching
+// .raw and .pgm paths write the grey image through a memory mapping instead of encoding a PNG
+void saveImage(string fpath, const vector<unsigned char>& img, int w, int h, int compressionLevel = -1);
+// 16-bit grey images, e.g. disparity maps of USE_DISP16 builds, as 16-bit PNG, PGM or raw
+void saveImage(string fpath, const vector<uint16_t> &img, int w, int h, int compressionLevel = -1);
+
+// Disparity maps as .raw files written through a memory mapping, the header type follows the element type
+void saveDisparityRaw(string fpath, const vector<unsigned char> &map, int w, int h);
+void saveDisparityRaw(string fpath, const vector<uint16_t> &map, int w, int h);
+void saveDisparityRaw(string fpath, const vector<float> &map, int w, int h);
+
+// 8- or 16-bit grey .raw or .pgm image created at its full size through a memory mapping and filled by rows, for
+// outputs too large to hold in memory. Written rows are released from the mapping. 16-bit PGM rows are stored
+// big-endian, raw rows in host byte order.
+class GrayImageWriter
+{
+public:
+    GrayImageWriter(string fpath, int w, int h, int bitDepth);
+
+    inline bool valid() const { return file && file->valid(); }
+
+    // numRows rows of width values starting at row y, the element type has to match bitDepth
+    void writeRows(int y, const unsigned char *rows, int numRows);
+    void writeRows(int y, const uint16_t *rows, int numRows);
+
+private:
+    unique_ptr<MappedFile> file;
+    size_t offset = 0; // size of the header
+    int width;
+    int bitDepth;
+    bool bigEndian;
+};
\ No newline at end of file
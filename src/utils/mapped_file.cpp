@@ -0,0 +1,101 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const string &path)
+{
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER fileSize;
+    if (fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+        return;
+
+    length = static_cast<size_t>(fileSize.QuadPart);
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle)
+        ptr = static_cast<unsigned char *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, length));
+}
+
+MappedFile::MappedFile(const string &path, size_t size)
+{
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE || size == 0)
+        return;
+
+    // Creating the mapping with a size grows the file to it
+    length = size;
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size), NULL);
+    if (mappingHandle)
+        ptr = static_cast<unsigned char *>(MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, length));
+}
+
+// Mapped views are trimmed from the working set by the system, nothing to do
+void MappedFile::release(size_t offset, size_t size)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    if (ptr)
+        UnmapViewOfFile(ptr);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle && fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(fileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const string &path)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+        return;
+
+    length = static_cast<size_t>(st.st_size);
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED)
+        ptr = static_cast<unsigned char *>(mapped);
+}
+
+MappedFile::MappedFile(const string &path, size_t size)
+{
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || size == 0 || ftruncate(fd, static_cast<off_t>(size)) != 0)
+        return;
+
+    length = size;
+    void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped != MAP_FAILED)
+        ptr = static_cast<unsigned char *>(mapped);
+}
+
+void MappedFile::release(size_t offset, size_t size)
+{
+    // whole pages inside the range only, the ones at its ends may still be in use
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t begin = (offset + pageSize - 1) / pageSize * pageSize;
+    const size_t end = min(offset + size, length) / pageSize * pageSize;
+    if (ptr && end > begin)
+        madvise(ptr + begin, end - begin, MADV_DONTNEED);
+}
+
+MappedFile::~MappedFile()
+{
+    if (ptr)
+        munmap(ptr, length);
+    if (fd >= 0)
+        close(fd);
+}
+
+#endif
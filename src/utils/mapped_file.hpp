@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+// File mapped into memory, read-only when opened, read-write when created with a size. The mapping is
+// released, and a created file written back, when the object goes out of scope.
+class MappedFile
+{
+public:
+    explicit MappedFile(const string &path);
+    MappedFile(const string &path, size_t size);
+    ~MappedFile();
+
+    inline bool valid() const { return ptr != nullptr; }
+    inline unsigned char *data() const { return ptr; }
+    inline size_t size() const { return length; }
+
+    // Drops the pages of [offset, offset + size) from the process, they are read back from the file, or written to
+    // it first, if touched again. For files streamed through once, so their pages do not all stay resident.
+    void release(size_t offset, size_t size);
+
+private:
+    MappedFile(MappedFile const &);
+    void operator=(MappedFile const &);
+
+    unsigned char *ptr = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+// Bounded single-producer single-consumer ring buffer. It is lock-free: only the producer writes tail and only
+// the consumer writes head. push and pop wait while the queue is full or empty, yielding first, then sleeping
+// a little so that an idle stage does not take CPU time from the busy ones.
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+    void push(T item)
+    {
+        const size_t t = tail.load(memory_order_relaxed);
+        const size_t next = (t + 1) % slots.size();
+        for (int spins = 0; next == head.load(memory_order_acquire); spins++)
+            backoff(spins);
+
+        slots[t] = move(item);
+        tail.store(next, memory_order_release);
+    }
+
+    // Next item, nullopt once the producer has closed the queue and it is drained
+    optional<T> pop()
+    {
+        const size_t h = head.load(memory_order_relaxed);
+        for (int spins = 0; h == tail.load(memory_order_acquire); spins++)
+        {
+            // close() comes after the last push, so seeing it means tail is final
+            if (closed.load(memory_order_acquire) && h == tail.load(memory_order_acquire))
+                return nullopt;
+            backoff(spins);
+        }
+
+        optional<T> item(move(slots[h]));
+        head.store((h + 1) % slots.size(), memory_order_release);
+        return item;
+    }
+
+    // Called by the producer after its last push
+    void close() { closed.store(true, memory_order_release); }
+
+private:
+    static void backoff(int spins)
+    {
+        if (spins < 64)
+            this_thread::yield();
+        else
+            this_thread::sleep_for(chrono::microseconds(100));
+    }
+
+    vector<T> slots;
+    alignas(64) atomic<size_t> head{0};
+    alignas(64) atomic<size_t> tail{0};
+    atomic<bool> closed{false};
+};
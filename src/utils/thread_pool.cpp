@@ -0,0 +1,149 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <omp.h>
+#include "thread_pool.hpp"
+
+thread_local bool insideWorker = false;
+
+// Cores the process may run on (taskset, cgroups, job objects), empty where that cannot be queried
+vector<int> allowedCores()
+{
+    vector<int> cores;
+#ifdef _WIN32
+    DWORD_PTR processMask = 0, systemMask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+    {
+        for (int core = 0; core < 64; core++)
+            if (processMask & (1ull << core))
+                cores.push_back(core);
+    }
+#elif defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) == 0)
+    {
+        for (int core = 0; core < CPU_SETSIZE; core++)
+            if (CPU_ISSET(core, &cpuset))
+                cores.push_back(core);
+    }
+#endif
+    return cores;
+}
+
+bool pinToCore(thread &th, int core)
+{
+#ifdef _WIN32
+    return SetThreadAffinityMask(th.native_handle(), 1ull << core) != 0;
+#elif defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core, &cpuset);
+    return pthread_setaffinity_np(th.native_handle(), sizeof(cpu_set_t), &cpuset) == 0;
+#else
+    return false;
+#endif
+}
+
+// One worker per allowed core, so that a restricted affinity mask does not stack several workers on a core
+ThreadPool &ThreadPool::getInstance()
+{
+    static ThreadPool instance(allowedCores());
+    return instance;
+}
+
+// Without a known affinity mask the workers are not pinned and the OS places them
+ThreadPool::ThreadPool(const vector<int> &cores)
+{
+    const int numThreads = cores.empty() ? max(1u, thread::hardware_concurrency()) : static_cast<int>(cores.size());
+    int unpinned = 0;
+    for (int t = 0; t < numThreads; t++)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, t);
+        if (!cores.empty() && !pinToCore(workers.back(), cores[t]))
+            unpinned++;
+    }
+
+    if (unpinned > 0)
+        cout << "# Thread pool: " << unpinned << " of " << numThreads << " workers could not be pinned, left to the OS" << endl;
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::workerLoop(int t)
+{
+    insideWorker = true;
+    unsigned long long seen = 0;
+
+    while (true)
+    {
+        unique_lock<mutex> lock(m);
+        wakeUp.wait(lock, [&]() { return stopping || generation != seen; });
+        if (stopping)
+            return;
+        seen = generation;
+        auto fn = job;
+        lock.unlock();
+
+        (*fn)(t);
+
+        lock.lock();
+        if (--pending == 0)
+            finished.notify_one();
+    }
+}
+
+void ThreadPool::run(const function<void(int)> &fn)
+{
+    // inside an OpenMP region the other cores are already busy with its threads, waking the
+    // workers pinned to them would oversubscribe the cores
+    if (insideWorker || omp_in_parallel())
+    {
+        for (int t = 0; t < size(); t++)
+            fn(t);
+        return;
+    }
+
+    lock_guard<mutex> runLock(runMutex);
+    unique_lock<mutex> lock(m);
+    job = &fn;
+    pending = size();
+    generation++;
+    wakeUp.notify_all();
+
+    finished.wait(lock, [&]() { return pending == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::parallelFor(int begin, int end, const function<void(int, int)> &fn)
+{
+    if (end <= begin)
+        return;
+
+    // a few chunks per worker, so that uneven chunks even out
+    const int chunk = max(1, (end - begin) / (4 * size()));
+    atomic<int> next(begin);
+
+    run([&](int)
+        {
+        for (int i0 = next.fetch_add(chunk); i0 < end; i0 = next.fetch_add(chunk))
+        {
+            fn(i0, min(end, i0 + chunk));
+        } });
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+// Process-wide pool of workers pinned to one core each of the process affinity mask, following the Singleton
+// pattern so the threads and their caches survive across frames and parameter sweeps
+class ThreadPool
+{
+public:
+    static ThreadPool &getInstance();
+    ~ThreadPool();
+
+    inline int size() const { return static_cast<int>(workers.size()); }
+
+    // Runs fn(t) once on every worker t in [0, size()) and waits for all of them.
+    // Called from inside a worker or an OpenMP parallel region it runs them in turn on that thread instead.
+    void run(const function<void(int)> &fn);
+
+    // Runs fn(i0, i1) over chunks of [begin, end) handed out to the workers as they free up
+    void parallelFor(int begin, int end, const function<void(int, int)> &fn);
+
+private:
+    ThreadPool(const vector<int> &cores);
+    ThreadPool(ThreadPool const &);
+    void operator=(ThreadPool const &);
+
+    void workerLoop(int t);
+
+    vector<thread> workers;
+    mutex runMutex; // one job at a time
+    mutex m;
+    condition_variable wakeUp;
+    condition_variable finished;
+    const function<void(int)> *job = nullptr;
+    unsigned long long generation = 0;
+    int pending = 0;
+    bool stopping = false;
+};
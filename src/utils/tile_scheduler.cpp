@@ -0,0 +1,101 @@
+#include "tile_scheduler.hpp"
+
+struct TileQueue
+{
+    mutex m;
+    deque<Tile> tiles;
+};
+
+bool popBack(TileQueue &queue, Tile &tile)
+{
+    lock_guard<mutex> lock(queue.m);
+    if (queue.tiles.empty())
+        return false;
+    tile = queue.tiles.back();
+    queue.tiles.pop_back();
+    return true;
+}
+
+bool stealFront(TileQueue &queue, Tile &tile)
+{
+    lock_guard<mutex> lock(queue.m);
+    if (queue.tiles.empty())
+        return false;
+    tile = queue.tiles.front();
+    queue.tiles.pop_front();
+    return true;
+}
+
+SchedulerStats runTiles(int width, int height, int tileWidth, int tileHeight, const function<void(const Tile &)> &work)
+{
+    ThreadPool &pool = ThreadPool::getInstance();
+    const int numThreads = pool.size();
+    tileWidth = tileWidth > 0 ? min(tileWidth, width) : width;
+    tileHeight = tileHeight > 0 ? min(tileHeight, height) : height;
+
+    vector<Tile> tiles;
+    for (int y = 0; y < height; y += tileHeight)
+    {
+        for (int x = 0; x < width; x += tileWidth)
+        {
+            tiles.push_back({x, y, min(width, x + tileWidth), min(height, y + tileHeight)});
+        }
+    }
+
+    const int numTiles = static_cast<int>(tiles.size());
+    SchedulerStats stats{numTiles, vector<long long>(numThreads, 0), vector<int>(numThreads, 0), vector<int>(numThreads, 0)};
+
+    // Tiles are never added once the threads start, so a thread that finds every deque empty is done
+    vector<TileQueue> queues(numThreads);
+    for (int t = 0; t < numThreads; t++)
+    {
+        queues[t].tiles.assign(tiles.begin() + t * numTiles / numThreads, tiles.begin() + (t + 1) * numTiles / numThreads);
+    }
+
+    auto worker = [&](int t)
+    {
+        Tile tile;
+        while (true)
+        {
+            if (!popBack(queues[t], tile))
+            {
+                bool stolen = false;
+                for (int k = 1; k < numThreads && !stolen; k++)
+                {
+                    stolen = stealFront(queues[(t + k) % numThreads], tile);
+                }
+                if (!stolen)
+                    break;
+                stats.tilesStolen[t]++;
+            }
+
+            auto start = chrono::high_resolution_clock::now();
+            work(tile);
+            stats.busyUs[t] += chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count();
+            stats.tilesRun[t]++;
+        }
+    };
+
+    pool.run(worker);
+
+    return stats;
+}
+
+void printSchedulerStats(const SchedulerStats &stats)
+{
+    const int numThreads = static_cast<int>(stats.busyUs.size());
+    long long maxBusy = 0, totalBusy = 0;
+    for (int t = 0; t < numThreads; t++)
+    {
+        maxBusy = max(maxBusy, stats.busyUs[t]);
+        totalBusy += stats.busyUs[t];
+    }
+
+    cout << "# Scheduler: " << stats.numTiles << " tiles on " << numThreads << " threads\n";
+    for (int t = 0; t < numThreads; t++)
+    {
+        cout << "#   thread " << t << ": busy " << stats.busyUs[t] << " us, " << stats.tilesRun[t] << " tiles, " << stats.tilesStolen[t] << " stolen\n";
+    }
+    // max over mean busy time, 1 is a perfect balance
+    cout << "#   imbalance " << fixed << setprecision(2) << (totalBusy > 0 ? maxBusy * numThreads / static_cast<double>(totalBusy) : 1.0) << endl;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// Rectangle [x0, x1) x [y0, y1) of the image
+struct Tile
+{
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+// Per-thread counters of a scheduler run, to measure load imbalance
+struct SchedulerStats
+{
+    int numTiles;
+    vector<long long> busyUs;
+    vector<int> tilesRun;
+    vector<int> tilesStolen;
+};
+
+// Work-stealing scheduler over 2D tiles on the ThreadPool workers: each worker starts with a contiguous
+// block of tiles in its own deque, works from the back of it and steals from the front of the others
+SchedulerStats runTiles(int width, int height, int tileWidth, int tileHeight, const function<void(const Tile &)> &work);
+
+void printSchedulerStats(const SchedulerStats &stats);
@@ -3,7 +3,7 @@
 mutex cout_mutex;
 
 // Single threaded ZNCC
-void zncc_single(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+void zncc_single(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
 {
     const int numPixels = znccParams.width * znccParams.height;
 
@@ -30,7 +30,7 @@ void zncc_single(vector<unsigned char> &dispMap, const vector<unsigned char> &le
             }
         }
 
-        dispMap[idx] = static_cast<unsigned char>(bestDisp);
+        dispMap[idx] = static_cast<disp_t>(bestDisp);
 
         if (idx > 0 && idx % (znccParams.width * 100) == 0)
         {
@@ -41,56 +41,50 @@ void zncc_single(vector<unsigned char> &dispMap, const vector<unsigned char> &le
     // cout << "ZNCC min,max = " << (int)*min_element(disparityImg.begin(), disparityImg.end()) << "," << (int)*max_element(disparityImg.begin(), disparityImg.end()) << endl;
 }
 
-// Multi threaded ZNCC
-void zncc_multi(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+void score_pixel(int x, int y, vector<double> &znccVals, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
 {
-    const int num_threads = thread::hardware_concurrency();
-    const int chunk_size = znccParams.height / num_threads;
+    double mean1 = calculateMean(x, y, leftImg, znccParams);
 
-    vector<thread> threads(num_threads);
-
-    for (int t = 0; t < num_threads; t++)
+    for (int d = 0; d < znccParams.maxDisp; d++)
     {
-        const int start_row = t * chunk_size;
-        const int end_row = (t == num_threads - 1) ? znccParams.height : (t + 1) * chunk_size;
+        double mean2 = calculateMean(x - d, y, rightImg, znccParams);
+        znccVals[d] = calculateZncc(x, y, d, mean1, mean2, leftImg, rightImg, znccParams);
+    }
+}
 
-        threads[t] = thread([=, &leftImg, &rightImg, &dispMap]()
-                            {
-            for (int idx = start_row * znccParams.width; idx < end_row * znccParams.width; idx++) 
+// Multi threaded ZNCC, tiles of the image are balanced across the threads by work stealing
+void zncc_multi(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    auto stats = runTiles(znccParams.width, znccParams.height, znccParams.tileWidth, znccParams.tileHeight, [&](const Tile &tile)
+                          {
+        vector<double> znccVals(znccParams.maxDisp);
+
+        for (int y = tile.y0; y < tile.y1; y++)
+        {
+            for (int x = tile.x0; x < tile.x1; x++)
             {
-                int j = idx / znccParams.width;
-                int i = idx % znccParams.width;
+                score_pixel(x, y, znccVals, leftImg, rightImg, znccParams);
 
                 double maxZncc = -1.0;
                 int bestDisp = 0;
 
-                double mean1 = calculateMean(i, j, leftImg, znccParams);
-
                 for (int d = 0; d < znccParams.maxDisp; d++)
                 {
-                    double mean2 = calculateMean(i - d, j, rightImg, znccParams);
-
-                    double znccVal = calculateZncc(i, j, d, mean1, mean2, leftImg, rightImg, znccParams);
-
-                    if (znccVal > maxZncc)
+                    if (znccVals[d] > maxZncc)
                     {
-                        maxZncc = znccVal;
+                        maxZncc = znccVals[d];
                         bestDisp = d;
                     }
                 }
 
-                dispMap[idx] = static_cast<unsigned char>(bestDisp);
-            } });
-    }
+                dispMap[y * znccParams.width + x] = static_cast<disp_t>(bestDisp);
+            }
+        } });
 
-    for (int t = 0; t < num_threads; t++)
-    {
-        threads[t].join();
-    }
+    printSchedulerStats(stats);
 }
 
-
-void zncc_openmp(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+void zncc_openmp(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
 {
     const int numPixels = znccParams.width * znccParams.height;
 
@@ -118,12 +112,26 @@ void zncc_openmp(vector<unsigned char> &dispMap, const vector<unsigned char> &le
             }
         }
 
-        dispMap[idx] = static_cast<unsigned char>(bestDisp);
+        dispMap[idx] = static_cast<disp_t>(bestDisp);
+    }
+}
+
+// Scores of all disparities of a pixel from exact integer window sums, int32 per row and int64 per window
+void score_pixel_simd_int(int x, int y, vector<double> &znccVals, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    const int halfWinSize = znccParams.winSize / 2;
+    auto [meanSum1, meanCount1] = calculateSumSimdInt(x, y, znccParams.width, znccParams.height, halfWinSize, leftImg);
+
+    for (int d = 0; d < znccParams.maxDisp; d++)
+    {
+        auto [meanSum2, meanCount2] = calculateSumSimdInt(x - d, y, znccParams.width, znccParams.height, halfWinSize, rightImg);
+        auto sums = calculateZnccSumsSimdInt(x, y, d, znccParams.width, znccParams.height, halfWinSize, leftImg, rightImg);
+        znccVals[d] = calculateZnccFromSums(sums, meanSum1, meanCount1, meanSum2, meanCount2);
     }
 }
 
 #ifdef USE_SIMD
-void zncc_simd(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+void zncc_simd(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
 {
     const int numPixels = znccParams.width * znccParams.height;
 
@@ -139,18 +147,25 @@ void zncc_simd(vector<unsigned char> &dispMap, const vector<unsigned char> &left
         auto meanVals = vector<double>(znccParams.maxDisp);
         auto znccVals = vector<double>(znccParams.maxDisp);
 
-        double mean1 = calculateMeanSimd(x, y, znccParams.width, znccParams.height, znccParams.winSize / 2, leftImg);
-
-// #pragma omp parallel for simd
-        for (int d = 0; d < znccParams.maxDisp; d++)
+        if (znccParams.precision == ZnccPrecision::INTEGER)
         {
-            meanVals[d] = calculateMeanSimd(x - d, y, znccParams.width, znccParams.height, znccParams.winSize / 2, rightImg);
+            score_pixel_simd_int(x, y, znccVals, leftImg, rightImg, znccParams);
         }
+        else
+        {
+            double mean1 = calculateMeanSimd(x, y, znccParams.width, znccParams.height, znccParams.winSize / 2, leftImg);
 
 // #pragma omp parallel for simd
-        for (int d = 0; d < znccParams.maxDisp; d++)
-        {
-            znccVals[d] = calculateZnccSimd(x, y, d, mean1, meanVals[d], znccParams.width, znccParams.height, znccParams.winSize / 2, leftImg, rightImg);
+            for (int d = 0; d < znccParams.maxDisp; d++)
+            {
+                meanVals[d] = calculateMeanSimd(x - d, y, znccParams.width, znccParams.height, znccParams.winSize / 2, rightImg);
+            }
+
+// #pragma omp parallel for simd
+            for (int d = 0; d < znccParams.maxDisp; d++)
+            {
+                znccVals[d] = calculateZnccSimd(x, y, d, mean1, meanVals[d], znccParams.width, znccParams.height, znccParams.winSize / 2, leftImg, rightImg);
+            }
         }
 
 // #pragma omp parallel for simd
@@ -163,19 +178,581 @@ void zncc_simd(vector<unsigned char> &dispMap, const vector<unsigned char> &left
             }
         }
 
-        dispMap[idx] = static_cast<unsigned char>(bestDisp);
+        dispMap[idx] = static_cast<disp_t>(bestDisp);
     }
 }
 
 #else
-void zncc_simd(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+void zncc_simd(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
 {
     cout << "SIMD not enabled" << endl;
 }
 #endif
 
 
-void zncc_cuda(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+// Scores of all disparities of a pixel with the hand-written row kernels
+void score_pixel_intrinsics(int x, int y, vector<double> &znccVals, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, const SimdKernels &kernels)
+{
+    // windows past the int32 range of the kernels take the int64 totals of the integer SIMD path
+    if (!intrinsicsWindowFits(znccParams.winSize))
+    {
+        score_pixel_simd_int(x, y, znccVals, leftImg, rightImg, znccParams);
+        return;
+    }
+
+    const int halfWinSize = znccParams.winSize / 2;
+    auto [meanSum1, meanCount1] = calculateSumIntrinsics(x, y, znccParams.width, znccParams.height, halfWinSize, leftImg, kernels);
+
+    for (int d = 0; d < znccParams.maxDisp; d++)
+    {
+        auto [meanSum2, meanCount2] = calculateSumIntrinsics(x - d, y, znccParams.width, znccParams.height, halfWinSize, rightImg, kernels);
+        auto sums = calculateZnccSumsIntrinsics(x, y, d, znccParams.width, znccParams.height, halfWinSize, leftImg, rightImg, kernels);
+        znccVals[d] = calculateZnccFromSums(sums, meanSum1, meanCount1, meanSum2, meanCount2);
+    }
+}
+
+// SIMD ZNCC with explicit SSE4.2 / AVX2 / AVX-512BW kernels picked at runtime, same results as the integer SIMD path
+void zncc_simd_intrinsics(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    const int numPixels = znccParams.width * znccParams.height;
+    const SimdKernels kernels = getSimdKernels(znccParams.simdIsa);
+    cout << "# SIMD kernels: " << SimdIsaToString(kernels.isa) << (intrinsicsWindowFits(znccParams.winSize) ? "" : ", int64 sums for winSize " + to_string(znccParams.winSize)) << endl;
+
+#pragma omp parallel for
+    for (int idx = 0; idx < numPixels; idx++)
+    {
+        int x = idx % znccParams.width;
+        int y = idx / znccParams.width;
+
+        double maxZncc = -1.0;
+        int bestDisp = 0;
+
+        auto znccVals = vector<double>(znccParams.maxDisp);
+        score_pixel_intrinsics(x, y, znccVals, leftImg, rightImg, znccParams, kernels);
+
+        for (int d = 0; d < znccParams.maxDisp; d++)
+        {
+            if (znccVals[d] > maxZncc)
+            {
+                maxZncc = znccVals[d];
+                bestDisp = d;
+            }
+        }
+
+        dispMap[idx] = static_cast<disp_t>(bestDisp);
+    }
+}
+
+mutex bounded_search_mutex;
+BoundedSearchStats boundedSearchStats;
+
+BoundedSearchStats getBoundedSearchStats()
+{
+    lock_guard<mutex> lock(bounded_search_mutex);
+    return boundedSearchStats;
+}
+
+void printBoundedSearchStats(const BoundedSearchStats &stats)
+{
+    cout << "# Bounded search: " << fixed << setprecision(1) << (stats.rowsTotal > 0 ? 100.0 * stats.rowsEvaluated / stats.rowsTotal : 0.0) << "% of window rows evaluated, "
+         << (stats.candidates > 0 ? 100.0 * stats.abandoned / stats.candidates : 0.0) << "% of " << stats.candidates << " candidates abandoned" << endl;
+}
+
+// ZNCC with window means and energies looked up from integral images, only the cross term is summed per disparity.
+// With boundedSearch, the cross term is summed row by row, scaled like calculateZnccFromSums: the rows done give
+// their exact share of the numerator, and by Cauchy-Schwarz the remaining ones add at most the square root of the
+// product of their two energies. A disparity is dropped once that bound cannot beat the best score. The search
+// starts at the disparity of the left neighbour and keeps the smallest disparity on ties, so the maps are unchanged.
+void zncc_integral(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const IntegralImage &leftIntegral, const IntegralImage &rightIntegral, const ZnccParams &znccParams)
+{
+    const int width = znccParams.width;
+    const int height = znccParams.height;
+    const int halfWinSize = znccParams.winSize / 2;
+    BoundedSearchStats callStats;
+
+#pragma omp parallel
+    {
+        BoundedSearchStats stats;
+
+#pragma omp for schedule(dynamic)
+    for (int y = 0; y < height; y++)
+    {
+        int y0 = max(0, y - halfWinSize);
+        int y1 = min(height, y + halfWinSize + 1);
+        int prevBestDisp = 0;
+
+        for (int x = 0; x < width; x++)
+        {
+            int x0 = max(0, x - halfWinSize);
+            int x1 = min(width, x + halfWinSize + 1);
+
+            long long meanCount1 = (x1 - x0) * (y1 - y0);
+            long long meanSum1 = integralSum(leftIntegral.sum, width, x0, y0, x1, y1);
+
+            double maxZncc = -1.0;
+            int bestDisp = 0;
+
+            for (int i = 0; i < znccParams.maxDisp; i++)
+            {
+                // with the bound, the neighbour's disparity goes first and takes the place of 0
+                int d = i;
+                if (znccParams.boundedSearch)
+                    d = i == 0 ? prevBestDisp : (i == prevBestDisp ? 0 : i);
+
+                // window of the right image mean, centered at x - d
+                int xm0 = max(0, x - d - halfWinSize);
+                int xm1 = min(width, x - d + halfWinSize + 1);
+                long long meanCount2 = max(0, xm1 - xm0) * (y1 - y0);
+                long long meanSum2 = meanCount2 > 0 ? integralSum(rightIntegral.sum, width, xm0, y0, xm1, y1) : 0;
+
+                // overlap of both windows, in left image coordinates
+                int xs0 = max(x0, d);
+                int xs1 = x1;
+
+                ZnccSums sums{0, 0, 0, 0, 0, 0};
+                bool abandoned = false;
+                if (xs1 > xs0)
+                {
+                    sums.count = (xs1 - xs0) * (y1 - y0);
+                    sums.sum1 = integralSum(leftIntegral.sum, width, xs0, y0, xs1, y1);
+                    sums.sqSum1 = integralSum(leftIntegral.sqSum, width, xs0, y0, xs1, y1);
+                    sums.sum2 = integralSum(rightIntegral.sum, width, xs0 - d, y0, xs1 - d, y1);
+                    sums.sqSum2 = integralSum(rightIntegral.sqSum, width, xs0 - d, y0, xs1 - d, y1);
+
+                    // scaled energies of both windows, the denominator of calculateZnccFromSums
+                    const long long denom1 = meanCount1 * meanCount1 * sums.sqSum1 - 2 * meanSum1 * meanCount1 * sums.sum1 + sums.count * meanSum1 * meanSum1;
+                    const long long denom2 = meanCount2 * meanCount2 * sums.sqSum2 - 2 * meanSum2 * meanCount2 * sums.sum2 + sums.count * meanSum2 * meanSum2;
+                    const double denom = sqrt(static_cast<double>(denom1) * static_cast<double>(denom2));
+                    const bool bounded = znccParams.boundedSearch && denom > 0.0;
+
+                    // integral table rows above the window, the sums of the rows done are read from a single table row
+                    const int stride = width + 1;
+                    ZnccSums top{0, 0, 0, 0, 0, 0};
+                    if (bounded)
+                    {
+                        top.sum1 = leftIntegral.sum[y0 * stride + xs1] - leftIntegral.sum[y0 * stride + xs0];
+                        top.sum2 = rightIntegral.sum[y0 * stride + xs1 - d] - rightIntegral.sum[y0 * stride + xs0 - d];
+                        top.sqSum1 = leftIntegral.sqSum[y0 * stride + xs1] - leftIntegral.sqSum[y0 * stride + xs0];
+                        top.sqSum2 = rightIntegral.sqSum[y0 * stride + xs1 - d] - rightIntegral.sqSum[y0 * stride + xs0 - d];
+                    }
+                    if (znccParams.boundedSearch)
+                    {
+                        stats.candidates++;
+                        stats.rowsTotal += y1 - y0;
+                    }
+
+                    for (int yy = y0; yy < y1; yy++)
+                    {
+                        const unsigned char *row1 = &leftImg[yy * width];
+                        const unsigned char *row2 = &rightImg[yy * width];
+                        long long crossSum = 0;
+                        for (int xx = xs0; xx < xs1; xx++)
+                        {
+                            crossSum += row1[xx] * row2[xx - d];
+                        }
+                        sums.crossSum += crossSum;
+                        if (znccParams.boundedSearch)
+                            stats.rowsEvaluated++;
+
+                        if (!bounded || yy + 1 == y1)
+                            continue;
+
+                        // numerator of the rows done, energies of the rows left
+                        const int bottom = (yy + 1) * stride;
+                        const long long count = (xs1 - xs0) * (yy + 1 - y0);
+                        const long long sum1 = leftIntegral.sum[bottom + xs1] - leftIntegral.sum[bottom + xs0] - top.sum1;
+                        const long long sum2 = rightIntegral.sum[bottom + xs1 - d] - rightIntegral.sum[bottom + xs0 - d] - top.sum2;
+                        const long long sqSum1 = leftIntegral.sqSum[bottom + xs1] - leftIntegral.sqSum[bottom + xs0] - top.sqSum1;
+                        const long long sqSum2 = rightIntegral.sqSum[bottom + xs1 - d] - rightIntegral.sqSum[bottom + xs0 - d] - top.sqSum2;
+                        const long long num = meanCount1 * meanCount2 * sums.crossSum - meanSum2 * meanCount1 * sum1 - meanSum1 * meanCount2 * sum2 + count * meanSum1 * meanSum2;
+                        const double rest1 = static_cast<double>(denom1 - (meanCount1 * meanCount1 * sqSum1 - 2 * meanSum1 * meanCount1 * sum1 + count * meanSum1 * meanSum1));
+                        const double rest2 = static_cast<double>(denom2 - (meanCount2 * meanCount2 * sqSum2 - 2 * meanSum2 * meanCount2 * sum2 + count * meanSum2 * meanSum2));
+
+                        // num + sqrt(rest1 * rest2) < maxZncc * denom, squared, the margin covers the rounding
+                        const double gap = (maxZncc - 1e-12) * denom - num;
+                        if (gap > 0.0 && rest1 * rest2 < gap * gap)
+                        {
+                            abandoned = true;
+                            stats.abandoned++;
+                            break;
+                        }
+                    }
+                }
+
+                if (abandoned)
+                    continue;
+
+                double znccVal = calculateZnccFromSums(sums, meanSum1, meanCount1, meanSum2, meanCount2);
+
+                if (znccVal > maxZncc || (znccVal == maxZncc && d < bestDisp))
+                {
+                    maxZncc = znccVal;
+                    bestDisp = d;
+                }
+            }
+
+            dispMap[y * width + x] = static_cast<disp_t>(bestDisp);
+            prevBestDisp = bestDisp;
+        }
+    }
+
+#pragma omp critical
+        {
+            callStats.candidates += stats.candidates;
+            callStats.abandoned += stats.abandoned;
+            callStats.rowsEvaluated += stats.rowsEvaluated;
+            callStats.rowsTotal += stats.rowsTotal;
+        }
+    }
+
+    // callers print the totals with printBoundedSearchStats
+    if (znccParams.boundedSearch)
+    {
+        lock_guard<mutex> lock(bounded_search_mutex);
+        boundedSearchStats.candidates += callStats.candidates;
+        boundedSearchStats.abandoned += callStats.abandoned;
+        boundedSearchStats.rowsEvaluated += callStats.rowsEvaluated;
+        boundedSearchStats.rowsTotal += callStats.rowsTotal;
+    }
+}
+
+// ZNCC with running sums: column sums are updated incrementally as the window moves down,
+// and row prefix sums of them give every window sum in O(1), whatever the window size
+// If rightDispMap is given, it is filled from the same scores, score(x, d) on the left being score(x - d, d) on the right
+// The sub-pixel maps, when given, are fitted from the scores kept next to the running argmax
+void zncc_sliding(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, DispMap *rightDispMap = nullptr, vector<float> *subDispMap = nullptr, vector<float> *rightSubDispMap = nullptr)
+{
+    const int width = znccParams.width;
+    const int height = znccParams.height;
+    const int maxDisp = znccParams.maxDisp;
+    const int halfWinSize = znccParams.winSize / 2;
+
+#pragma omp parallel
+    {
+        // each thread slides its window down its own band of rows
+        const int numThreads = omp_get_num_threads();
+        const int t = omp_get_thread_num();
+        const int startRow = t * height / numThreads;
+        const int endRow = (t + 1) * height / numThreads;
+
+        // column sums over the current window rows
+        vector<int> colSum1(width, 0), colSum2(width, 0), colSqSum1(width, 0), colSqSum2(width, 0);
+        vector<int> colCross(maxDisp * width, 0);
+
+        // prefix sums along the row, prefix[x] is the sum of columns [0, x)
+        vector<long long> prefix1(width + 1, 0), prefix2(width + 1, 0), sqPrefix1(width + 1, 0), sqPrefix2(width + 1, 0);
+        vector<long long> crossPrefix(width + 1, 0);
+
+        vector<double> maxZncc(width);
+        vector<int> bestDisp(width);
+        vector<double> rightMaxZncc(width);
+        vector<int> rightBestDisp(width);
+        SubPixelScores scores;
+        SubPixelScores rightScores;
+
+        auto updateRow = [&](int yy, int sign)
+        {
+            const unsigned char *row1 = &leftImg[yy * width];
+            const unsigned char *row2 = &rightImg[yy * width];
+            for (int x = 0; x < width; x++)
+            {
+                colSum1[x] += sign * row1[x];
+                colSum2[x] += sign * row2[x];
+                colSqSum1[x] += sign * row1[x] * row1[x];
+                colSqSum2[x] += sign * row2[x] * row2[x];
+            }
+            for (int d = 0; d < maxDisp; d++)
+            {
+                int *cross = &colCross[d * width];
+                for (int x = d; x < width; x++)
+                {
+                    cross[x] += sign * row1[x] * row2[x - d];
+                }
+            }
+        };
+
+        int curY0 = max(0, startRow - halfWinSize);
+        int curY1 = curY0;
+
+        for (int y = startRow; y < endRow; y++)
+        {
+            int y0 = max(0, y - halfWinSize);
+            int y1 = min(height, y + halfWinSize + 1);
+
+            for (; curY1 < y1; curY1++)
+                updateRow(curY1, 1);
+            for (; curY0 < y0; curY0++)
+                updateRow(curY0, -1);
+
+            for (int x = 0; x < width; x++)
+            {
+                prefix1[x + 1] = prefix1[x] + colSum1[x];
+                prefix2[x + 1] = prefix2[x] + colSum2[x];
+                sqPrefix1[x + 1] = sqPrefix1[x] + colSqSum1[x];
+                sqPrefix2[x + 1] = sqPrefix2[x] + colSqSum2[x];
+            }
+
+            fill(maxZncc.begin(), maxZncc.end(), -1.0);
+            fill(bestDisp.begin(), bestDisp.end(), 0);
+            fill(rightMaxZncc.begin(), rightMaxZncc.end(), -1.0);
+            fill(rightBestDisp.begin(), rightBestDisp.end(), 0);
+            if (subDispMap)
+                scores.reset(width);
+            if (rightSubDispMap)
+                rightScores.reset(width);
+
+            for (int d = 0; d < maxDisp; d++)
+            {
+                const int *cross = &colCross[d * width];
+                for (int x = 0; x < width; x++)
+                {
+                    crossPrefix[x + 1] = crossPrefix[x] + cross[x];
+                }
+
+                for (int x = 0; x < width; x++)
+                {
+                    int x0 = max(0, x - halfWinSize);
+                    int x1 = min(width, x + halfWinSize + 1);
+                    long long meanCount1 = (x1 - x0) * (y1 - y0);
+                    long long meanSum1 = prefix1[x1] - prefix1[x0];
+
+                    // window of the right image mean, centered at x - d
+                    int xm0 = max(0, x - d - halfWinSize);
+                    int xm1 = min(width, x - d + halfWinSize + 1);
+                    long long meanCount2 = max(0, xm1 - xm0) * (y1 - y0);
+                    long long meanSum2 = meanCount2 > 0 ? prefix2[xm1] - prefix2[xm0] : 0;
+
+                    // overlap of both windows, in left image coordinates
+                    int xs0 = max(x0, d);
+                    ZnccSums sums{0, 0, 0, 0, 0, 0};
+                    if (x1 > xs0)
+                    {
+                        sums.count = (x1 - xs0) * (y1 - y0);
+                        sums.sum1 = prefix1[x1] - prefix1[xs0];
+                        sums.sqSum1 = sqPrefix1[x1] - sqPrefix1[xs0];
+                        sums.sum2 = prefix2[x1 - d] - prefix2[xs0 - d];
+                        sums.sqSum2 = sqPrefix2[x1 - d] - sqPrefix2[xs0 - d];
+                        sums.crossSum = crossPrefix[x1] - crossPrefix[xs0];
+                    }
+
+                    double znccVal = calculateZnccFromSums(sums, meanSum1, meanCount1, meanSum2, meanCount2);
+
+                    const bool newBest = znccVal > maxZncc[x];
+                    if (newBest)
+                    {
+                        maxZncc[x] = znccVal;
+                        bestDisp[x] = d;
+                    }
+                    if (subDispMap)
+                        scores.update(x, d, znccVal, newBest, bestDisp[x]);
+
+                    if (rightDispMap && x - d >= 0)
+                    {
+                        const bool rightNewBest = znccVal > rightMaxZncc[x - d];
+                        if (rightNewBest)
+                        {
+                            rightMaxZncc[x - d] = znccVal;
+                            rightBestDisp[x - d] = d;
+                        }
+                        if (rightSubDispMap)
+                            rightScores.update(x - d, d, znccVal, rightNewBest, rightBestDisp[x - d]);
+                    }
+                }
+            }
+
+            for (int x = 0; x < width; x++)
+            {
+                dispMap[y * width + x] = static_cast<disp_t>(bestDisp[x]);
+                if (subDispMap)
+                    (*subDispMap)[y * width + x] = subPixelDisparity(bestDisp[x], scores.below[x], maxZncc[x], scores.above[x], znccParams.subPixel);
+                if (rightDispMap)
+                    (*rightDispMap)[y * width + x] = static_cast<disp_t>(rightBestDisp[x]);
+                if (rightDispMap && rightSubDispMap)
+                    (*rightSubDispMap)[y * width + x] = subPixelDisparity(rightBestDisp[x], rightScores.below[x], rightMaxZncc[x], rightScores.above[x], znccParams.subPixel);
+            }
+        }
+    }
+}
+
+// Disparity-major ZNCC: for each disparity the product image I1(x) * I2(x - d) of a band of rows
+// is box-filtered with a separable filter and a running argmax is kept per pixel
+void zncc_cost_volume(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const IntegralImage &leftIntegral, const IntegralImage &rightIntegral, const ZnccParams &znccParams, DispMap *rightDispMap = nullptr, vector<float> *subDispMap = nullptr, vector<float> *rightSubDispMap = nullptr)
+{
+    const int width = znccParams.width;
+    const int height = znccParams.height;
+    const int halfWinSize = znccParams.winSize / 2;
+    const int bandRows = max(1, znccParams.bandRows);
+    const int numBands = (height + bandRows - 1) / bandRows;
+
+#pragma omp parallel
+    {
+        vector<int> product((bandRows + 2 * halfWinSize) * width);
+        vector<int> boxed(bandRows * width);
+        vector<double> maxZncc(bandRows * width);
+        vector<int> bestDisp(bandRows * width);
+        vector<double> rightMaxZncc(bandRows * width);
+        vector<int> rightBestDisp(bandRows * width);
+        SubPixelScores scores;
+        SubPixelScores rightScores;
+
+#pragma omp for schedule(dynamic)
+        for (int band = 0; band < numBands; band++)
+        {
+            const int by0 = band * bandRows;
+            const int by1 = min(height, by0 + bandRows);
+            const int ey0 = max(0, by0 - halfWinSize);
+            const int ey1 = min(height, by1 + halfWinSize);
+
+            fill(maxZncc.begin(), maxZncc.end(), -1.0);
+            fill(bestDisp.begin(), bestDisp.end(), 0);
+            fill(rightMaxZncc.begin(), rightMaxZncc.end(), -1.0);
+            fill(rightBestDisp.begin(), rightBestDisp.end(), 0);
+            if (subDispMap)
+                scores.reset(bandRows * width);
+            if (rightSubDispMap)
+                rightScores.reset(bandRows * width);
+
+            for (int d = 0; d < znccParams.maxDisp; d++)
+            {
+                // Product image of the band and its halo rows
+                for (int yy = ey0; yy < ey1; yy++)
+                {
+                    const unsigned char *row1 = &leftImg[yy * width];
+                    const unsigned char *row2 = &rightImg[yy * width];
+                    int *prod = &product[(yy - ey0) * width];
+                    for (int x = 0; x < min(d, width); x++)
+                    {
+                        prod[x] = 0;
+                    }
+                    for (int x = d; x < width; x++)
+                    {
+                        prod[x] = row1[x] * row2[x - d];
+                    }
+                }
+
+                // Vertical box filter, each row is the previous one plus the incoming and minus the outgoing row
+                for (int y = by0; y < by1; y++)
+                {
+                    int y0 = max(0, y - halfWinSize);
+                    int y1 = min(height, y + halfWinSize + 1);
+                    int *box = &boxed[(y - by0) * width];
+
+                    if (y == by0)
+                    {
+                        fill(box, box + width, 0);
+                        for (int yy = y0; yy < y1; yy++)
+                        {
+                            const int *prod = &product[(yy - ey0) * width];
+                            for (int x = 0; x < width; x++)
+                            {
+                                box[x] += prod[x];
+                            }
+                        }
+                        continue;
+                    }
+
+                    const int *prevBox = box - width;
+                    const int *incoming = y + halfWinSize < height ? &product[(y + halfWinSize - ey0) * width] : nullptr;
+                    const int *outgoing = y - halfWinSize - 1 >= 0 ? &product[(y - halfWinSize - 1 - ey0) * width] : nullptr;
+                    for (int x = 0; x < width; x++)
+                    {
+                        box[x] = prevBox[x] + (incoming ? incoming[x] : 0) - (outgoing ? outgoing[x] : 0);
+                    }
+                }
+
+                // Horizontal box filter, then score and running argmax
+                for (int y = by0; y < by1; y++)
+                {
+                    int y0 = max(0, y - halfWinSize);
+                    int y1 = min(height, y + halfWinSize + 1);
+                    const int *box = &boxed[(y - by0) * width];
+                    double *bandMaxZncc = &maxZncc[(y - by0) * width];
+                    int *bandBestDisp = &bestDisp[(y - by0) * width];
+                    double *bandRightMaxZncc = &rightMaxZncc[(y - by0) * width];
+                    int *bandRightBestDisp = &rightBestDisp[(y - by0) * width];
+
+                    long long crossSum = 0;
+                    for (int x = 0; x < min(width, halfWinSize); x++)
+                    {
+                        crossSum += box[x];
+                    }
+
+                    for (int x = 0; x < width; x++)
+                    {
+                        int x0 = max(0, x - halfWinSize);
+                        int x1 = min(width, x + halfWinSize + 1);
+                        if (x + halfWinSize < width)
+                            crossSum += box[x + halfWinSize];
+                        if (x - halfWinSize - 1 >= 0)
+                            crossSum -= box[x - halfWinSize - 1];
+
+                        long long meanCount1 = (x1 - x0) * (y1 - y0);
+                        long long meanSum1 = integralSum(leftIntegral.sum, width, x0, y0, x1, y1);
+
+                        // window of the right image mean, centered at x - d
+                        int xm0 = max(0, x - d - halfWinSize);
+                        int xm1 = min(width, x - d + halfWinSize + 1);
+                        long long meanCount2 = max(0, xm1 - xm0) * (y1 - y0);
+                        long long meanSum2 = meanCount2 > 0 ? integralSum(rightIntegral.sum, width, xm0, y0, xm1, y1) : 0;
+
+                        // overlap of both windows, in left image coordinates
+                        int xs0 = max(x0, d);
+                        ZnccSums sums{0, 0, 0, 0, 0, 0};
+                        if (x1 > xs0)
+                        {
+                            sums.count = (x1 - xs0) * (y1 - y0);
+                            sums.sum1 = integralSum(leftIntegral.sum, width, xs0, y0, x1, y1);
+                            sums.sqSum1 = integralSum(leftIntegral.sqSum, width, xs0, y0, x1, y1);
+                            sums.sum2 = integralSum(rightIntegral.sum, width, xs0 - d, y0, x1 - d, y1);
+                            sums.sqSum2 = integralSum(rightIntegral.sqSum, width, xs0 - d, y0, x1 - d, y1);
+                            sums.crossSum = crossSum;
+                        }
+
+                        double znccVal = calculateZnccFromSums(sums, meanSum1, meanCount1, meanSum2, meanCount2);
+
+                        const bool newBest = znccVal > bandMaxZncc[x];
+                        if (newBest)
+                        {
+                            bandMaxZncc[x] = znccVal;
+                            bandBestDisp[x] = d;
+                        }
+                        if (subDispMap)
+                            scores.update((y - by0) * width + x, d, znccVal, newBest, bandBestDisp[x]);
+
+                        if (rightDispMap && x - d >= 0)
+                        {
+                            const bool rightNewBest = znccVal > bandRightMaxZncc[x - d];
+                            if (rightNewBest)
+                            {
+                                bandRightMaxZncc[x - d] = znccVal;
+                                bandRightBestDisp[x - d] = d;
+                            }
+                            if (rightSubDispMap)
+                                rightScores.update((y - by0) * width + x - d, d, znccVal, rightNewBest, bandRightBestDisp[x - d]);
+                        }
+                    }
+                }
+            }
+
+            for (int y = by0; y < by1; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    const int i = (y - by0) * width + x;
+                    dispMap[y * width + x] = static_cast<disp_t>(bestDisp[i]);
+                    if (subDispMap)
+                        (*subDispMap)[y * width + x] = subPixelDisparity(bestDisp[i], scores.below[i], maxZncc[i], scores.above[i], znccParams.subPixel);
+                    if (rightDispMap)
+                        (*rightDispMap)[y * width + x] = static_cast<disp_t>(rightBestDisp[i]);
+                    if (rightDispMap && rightSubDispMap)
+                        (*rightSubDispMap)[y * width + x] = subPixelDisparity(rightBestDisp[i], rightScores.below[i], rightMaxZncc[i], rightScores.above[i], znccParams.subPixel);
+                }
+            }
+        }
+    }
+}
+
+void zncc_cuda(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
 {
     #ifdef USE_CUDA
     zncc_cuda(&dispMap[0], &leftImg[0], &rightImg[0], znccParams.width, znccParams.height, znccParams.winSize, znccParams.maxDisp);
@@ -184,16 +761,513 @@ void zncc_cuda(vector<unsigned char> &dispMap, const vector<unsigned char> &left
     #endif
 }
 
-// ZNCC wrapper function
-void zncc(vector<unsigned char> &leftDispMap, vector<unsigned char> &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+// Fused left/right ZNCC: every score is evaluated once, score(x, d) of the left pixel x being the
+// score of the right pixel x - d at the same disparity. The right map therefore searches x + d in
+// the left image, like the reversed OpenCL kernels, and only sees candidates inside the left image.
+// With sub-pixel maps the left fit reads the neighbours from znccVals, and the right pixels, whose scores arrive in
+// increasing disparity order across the row, keep theirs in a SubPixelScores.
+template <typename ScoreFn>
+void zncc_fused_row(int y, DispMap &leftDispMap, DispMap &rightDispMap, const ZnccParams &znccParams, ScoreFn scorePixel, vector<float> *leftSubDispMap = nullptr, vector<float> *rightSubDispMap = nullptr)
 {
-    #ifndef USE_OCL
-    if (znccParams.method == ZnccMethod::OPENCL || znccParams.method == ZnccMethod::OPENCL_OPT)
+    const int width = znccParams.width;
+    vector<double> znccVals(znccParams.maxDisp);
+    vector<double> rightMaxZncc(width, -1.0);
+    vector<int> rightBestDisp(width, 0);
+    SubPixelScores rightScores;
+    if (rightSubDispMap)
+        rightScores.reset(width);
+
+    for (int x = 0; x < width; x++)
     {
-        cout << "OpenCL not enabled" << endl;
-        return;
+        scorePixel(x, y, znccVals);
+
+        double maxZncc = -1.0;
+        int bestDisp = 0;
+
+        for (int d = 0; d < znccParams.maxDisp; d++)
+        {
+            if (znccVals[d] > maxZncc)
+            {
+                maxZncc = znccVals[d];
+                bestDisp = d;
+            }
+
+            if (x - d >= 0)
+            {
+                const bool newBest = znccVals[d] > rightMaxZncc[x - d];
+                if (newBest)
+                {
+                    rightMaxZncc[x - d] = znccVals[d];
+                    rightBestDisp[x - d] = d;
+                }
+                if (rightSubDispMap)
+                    rightScores.update(x - d, d, znccVals[d], newBest, rightBestDisp[x - d]);
+            }
+        }
+
+        leftDispMap[y * width + x] = static_cast<disp_t>(bestDisp);
+        if (leftSubDispMap)
+        {
+            const double below = bestDisp > 0 ? znccVals[bestDisp - 1] : NAN;
+            const double above = bestDisp + 1 < znccParams.maxDisp ? znccVals[bestDisp + 1] : NAN;
+            (*leftSubDispMap)[y * width + x] = subPixelDisparity(bestDisp, below, maxZncc, above, znccParams.subPixel);
+        }
     }
-    #endif
+
+    for (int x = 0; x < width; x++)
+    {
+        rightDispMap[y * width + x] = static_cast<disp_t>(rightBestDisp[x]);
+        if (rightSubDispMap)
+            (*rightSubDispMap)[y * width + x] = subPixelDisparity(rightBestDisp[x], rightScores.below[x], rightMaxZncc[x], rightScores.above[x], znccParams.subPixel);
+    }
+}
+
+void zncc_single_fused(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+    auto scorePixel = [&](int x, int y, vector<double> &znccVals)
+    { score_pixel(x, y, znccVals, leftImg, rightImg, znccParams); };
+
+    for (int y = 0; y < znccParams.height; y++)
+    {
+        zncc_fused_row(y, leftDispMap, rightDispMap, znccParams, scorePixel, leftSubDispMap, rightSubDispMap);
+
+        if (y > 0 && y % 100 == 0)
+        {
+            cout << "Progress " << fixed << setprecision(2) << (y + 1) / static_cast<double>(znccParams.height) * 100 << " %, " << y + 1 << "/" << znccParams.height << " rows done!" << endl;
+        }
+    }
+}
+
+// Tiles span whole rows here, since a row updates right map pixels anywhere in that row
+void zncc_multi_fused(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+    auto scorePixel = [&](int x, int y, vector<double> &znccVals)
+    { score_pixel(x, y, znccVals, leftImg, rightImg, znccParams); };
+
+    auto stats = runTiles(znccParams.width, znccParams.height, znccParams.width, znccParams.tileHeight, [&](const Tile &tile)
+                          {
+        for (int y = tile.y0; y < tile.y1; y++)
+        {
+            zncc_fused_row(y, leftDispMap, rightDispMap, znccParams, scorePixel, leftSubDispMap, rightSubDispMap);
+        } });
+
+    printSchedulerStats(stats);
+}
+
+void zncc_openmp_fused(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+    auto scorePixel = [&](int x, int y, vector<double> &znccVals)
+    { score_pixel(x, y, znccVals, leftImg, rightImg, znccParams); };
+
+#pragma omp parallel for schedule(dynamic)
+    for (int y = 0; y < znccParams.height; y++)
+    {
+        zncc_fused_row(y, leftDispMap, rightDispMap, znccParams, scorePixel, leftSubDispMap, rightSubDispMap);
+    }
+}
+
+void zncc_simd_fused(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+#ifdef USE_SIMD
+    const int halfWinSize = znccParams.winSize / 2;
+    auto scorePixel = [&](int x, int y, vector<double> &znccVals)
+    {
+        if (znccParams.precision == ZnccPrecision::INTEGER)
+        {
+            score_pixel_simd_int(x, y, znccVals, leftImg, rightImg, znccParams);
+            return;
+        }
+
+        double mean1 = calculateMeanSimd(x, y, znccParams.width, znccParams.height, halfWinSize, leftImg);
+
+        for (int d = 0; d < znccParams.maxDisp; d++)
+        {
+            double mean2 = calculateMeanSimd(x - d, y, znccParams.width, znccParams.height, halfWinSize, rightImg);
+            znccVals[d] = calculateZnccSimd(x, y, d, mean1, mean2, znccParams.width, znccParams.height, halfWinSize, leftImg, rightImg);
+        }
+    };
+
+#pragma omp parallel for
+    for (int y = 0; y < znccParams.height; y++)
+    {
+        zncc_fused_row(y, leftDispMap, rightDispMap, znccParams, scorePixel, leftSubDispMap, rightSubDispMap);
+    }
+#else
+    cout << "SIMD not enabled" << endl;
+#endif
+}
+
+void zncc_simd_intrinsics_fused(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+    const SimdKernels kernels = getSimdKernels(znccParams.simdIsa);
+    cout << "# SIMD kernels: " << SimdIsaToString(kernels.isa) << (intrinsicsWindowFits(znccParams.winSize) ? "" : ", int64 sums for winSize " + to_string(znccParams.winSize)) << endl;
+
+    auto scorePixel = [&](int x, int y, vector<double> &znccVals)
+    { score_pixel_intrinsics(x, y, znccVals, leftImg, rightImg, znccParams, kernels); };
+
+#pragma omp parallel for
+    for (int y = 0; y < znccParams.height; y++)
+    {
+        zncc_fused_row(y, leftDispMap, rightDispMap, znccParams, scorePixel, leftSubDispMap, rightSubDispMap);
+    }
+}
+
+void zncc_templated_fused(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+    bool specialised = false;
+    const ZnccScoreFn scoreFn = getZnccScoreFn(znccParams.winSize, znccParams.maxDisp, &specialised);
+    cout << "# ZNCC kernel: " << (specialised ? "specialised" : "generic") << " for winSize " << znccParams.winSize << ", maxDisp " << znccParams.maxDisp << endl;
+
+    auto scorePixel = [&](int x, int y, vector<double> &znccVals)
+    { scoreFn(x, y, znccVals, leftImg, rightImg, znccParams); };
+
+#pragma omp parallel for schedule(dynamic)
+    for (int y = 0; y < znccParams.height; y++)
+    {
+        zncc_fused_row(y, leftDispMap, rightDispMap, znccParams, scorePixel, leftSubDispMap, rightSubDispMap);
+    }
+}
+
+void zncc_integral_fused(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+    const int width = znccParams.width;
+    const int height = znccParams.height;
+    const int halfWinSize = znccParams.winSize / 2;
+    auto leftIntegral = buildIntegralImage(leftImg, width, height);
+    auto rightIntegral = buildIntegralImage(rightImg, width, height);
+
+    auto scorePixel = [&](int x, int y, vector<double> &znccVals)
+    {
+        int y0 = max(0, y - halfWinSize);
+        int y1 = min(height, y + halfWinSize + 1);
+        int x0 = max(0, x - halfWinSize);
+        int x1 = min(width, x + halfWinSize + 1);
+
+        long long meanCount1 = (x1 - x0) * (y1 - y0);
+        long long meanSum1 = integralSum(leftIntegral.sum, width, x0, y0, x1, y1);
+
+        for (int d = 0; d < znccParams.maxDisp; d++)
+        {
+            int xm0 = max(0, x - d - halfWinSize);
+            int xm1 = min(width, x - d + halfWinSize + 1);
+            long long meanCount2 = max(0, xm1 - xm0) * (y1 - y0);
+            long long meanSum2 = meanCount2 > 0 ? integralSum(rightIntegral.sum, width, xm0, y0, xm1, y1) : 0;
+
+            int xs0 = max(x0, d);
+            ZnccSums sums{0, 0, 0, 0, 0, 0};
+            if (x1 > xs0)
+            {
+                sums.count = (x1 - xs0) * (y1 - y0);
+                sums.sum1 = integralSum(leftIntegral.sum, width, xs0, y0, x1, y1);
+                sums.sqSum1 = integralSum(leftIntegral.sqSum, width, xs0, y0, x1, y1);
+                sums.sum2 = integralSum(rightIntegral.sum, width, xs0 - d, y0, x1 - d, y1);
+                sums.sqSum2 = integralSum(rightIntegral.sqSum, width, xs0 - d, y0, x1 - d, y1);
+
+                for (int yy = y0; yy < y1; yy++)
+                {
+                    const unsigned char *row1 = &leftImg[yy * width];
+                    const unsigned char *row2 = &rightImg[yy * width];
+                    long long crossSum = 0;
+                    for (int xx = xs0; xx < x1; xx++)
+                    {
+                        crossSum += row1[xx] * row2[xx - d];
+                    }
+                    sums.crossSum += crossSum;
+                }
+            }
+
+            znccVals[d] = calculateZnccFromSums(sums, meanSum1, meanCount1, meanSum2, meanCount2);
+        }
+    };
+
+#pragma omp parallel for schedule(dynamic)
+    for (int y = 0; y < height; y++)
+    {
+        zncc_fused_row(y, leftDispMap, rightDispMap, znccParams, scorePixel, leftSubDispMap, rightSubDispMap);
+    }
+}
+
+// Returns false for methods without a fused CPU path, which then run the two passes as usual
+bool zncc_fused(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+    switch (znccParams.method)
+    {
+    case ZnccMethod::SINGLE_THREADED:
+        zncc_single_fused(leftDispMap, rightDispMap, leftImg, rightImg, znccParams, leftSubDispMap, rightSubDispMap);
+        return true;
+    case ZnccMethod::MULTI_THREADED:
+        zncc_multi_fused(leftDispMap, rightDispMap, leftImg, rightImg, znccParams, leftSubDispMap, rightSubDispMap);
+        return true;
+    case ZnccMethod::OPENMP:
+        zncc_openmp_fused(leftDispMap, rightDispMap, leftImg, rightImg, znccParams, leftSubDispMap, rightSubDispMap);
+        return true;
+    case ZnccMethod::SIMD:
+        zncc_simd_fused(leftDispMap, rightDispMap, leftImg, rightImg, znccParams, leftSubDispMap, rightSubDispMap);
+        return true;
+    case ZnccMethod::SIMD_INTRINSICS:
+        zncc_simd_intrinsics_fused(leftDispMap, rightDispMap, leftImg, rightImg, znccParams, leftSubDispMap, rightSubDispMap);
+        return true;
+    case ZnccMethod::TEMPLATED:
+        zncc_templated_fused(leftDispMap, rightDispMap, leftImg, rightImg, znccParams, leftSubDispMap, rightSubDispMap);
+        return true;
+    case ZnccMethod::INTEGRAL:
+        zncc_integral_fused(leftDispMap, rightDispMap, leftImg, rightImg, znccParams, leftSubDispMap, rightSubDispMap);
+        return true;
+    case ZnccMethod::SLIDING_WINDOW:
+        zncc_sliding(leftDispMap, leftImg, rightImg, znccParams, &rightDispMap, leftSubDispMap, rightSubDispMap);
+        return true;
+    case ZnccMethod::COST_VOLUME:
+    {
+        auto leftIntegral = buildIntegralImage(leftImg, znccParams.width, znccParams.height);
+        auto rightIntegral = buildIntegralImage(rightImg, znccParams.width, znccParams.height);
+        zncc_cost_volume(leftDispMap, leftImg, rightImg, leftIntegral, rightIntegral, znccParams, &rightDispMap, leftSubDispMap, rightSubDispMap);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+size_t l2CacheSize()
+{
+#if defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (size > 0)
+        return static_cast<size_t>(size);
+#endif
+    return 256 * 1024;
+}
+
+// Largest square tile whose two scratch images, halo included, fill at most half of L2
+int pickCacheTileSize(const ZnccParams &znccParams, int dispHalo)
+{
+    if (znccParams.cacheTileSize > 0)
+        return znccParams.cacheTileSize;
+
+    const size_t budget = l2CacheSize() / 2;
+    const int halo = 2 * (znccParams.winSize / 2);
+    int tileSize = 8;
+    while (2 * static_cast<size_t>(tileSize + 8 + halo + dispHalo) * (tileSize + 8 + halo) <= budget)
+    {
+        tileSize += 8;
+    }
+    return tileSize;
+}
+
+// Scratch images of a worker, kept across tiles and calls so that a tile reuses the memory of the one before
+struct TileScratch
+{
+    vector<unsigned char> left;
+    vector<unsigned char> right;
+    vector<double> znccVals;
+};
+thread_local TileScratch tileScratch;
+
+// Cache-blocked ZNCC: each tile is copied with its halo (winSize / 2 around it, plus maxDisp - 1 to the
+// left for the disparities) into contiguous scratch images, and scorePixel runs on those. The halo
+// is clipped at the image borders only, so the windows see the same pixels as on the whole image.
+// The SIMD kernels stop their windows at width - d, they need the disparity halo on the right too.
+// matchInside drops the disparities whose match x - d lies outside the image, as the fused right map does.
+template <typename ScoreFn>
+void zncc_cache_tiled(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, ScoreFn scorePixel, bool rightDispHalo = false, bool matchInside = false)
+{
+    const int halfWinSize = znccParams.winSize / 2;
+    const int dispHalo = znccParams.maxDisp - 1;
+    const int tileSize = pickCacheTileSize(znccParams, rightDispHalo ? 2 * dispHalo : dispHalo);
+    cout << "# Cache tiling: " << tileSize << "x" << tileSize << " tiles, halo " << halfWinSize << " + " << dispHalo << ", L2 " << l2CacheSize() / 1024 << " KB" << endl;
+
+    auto stats = runTiles(znccParams.width, znccParams.height, tileSize, tileSize, [&](const Tile &tile)
+                          {
+        const int sx0 = max(0, tile.x0 - halfWinSize - dispHalo);
+        const int sx1 = min(znccParams.width, tile.x1 + halfWinSize + (rightDispHalo ? dispHalo : 0));
+        const int sy0 = max(0, tile.y0 - halfWinSize);
+        const int sy1 = min(znccParams.height, tile.y1 + halfWinSize);
+
+        ZnccParams tileParams = znccParams;
+        tileParams.width = sx1 - sx0;
+        tileParams.height = sy1 - sy0;
+
+        // resized within their capacity after the first tiles, the score functions read the scratch images
+        // through tileParams only
+        auto &tileLeft = tileScratch.left;
+        auto &tileRight = tileScratch.right;
+        auto &znccVals = tileScratch.znccVals;
+        tileLeft.resize(tileParams.width * tileParams.height);
+        tileRight.resize(tileParams.width * tileParams.height);
+        znccVals.resize(znccParams.maxDisp);
+        for (int y = sy0; y < sy1; y++)
+        {
+            copy(&leftImg[y * znccParams.width + sx0], &leftImg[y * znccParams.width + sx1], &tileLeft[(y - sy0) * tileParams.width]);
+            copy(&rightImg[y * znccParams.width + sx0], &rightImg[y * znccParams.width + sx1], &tileRight[(y - sy0) * tileParams.width]);
+        }
+
+        for (int y = tile.y0; y < tile.y1; y++)
+        {
+            for (int x = tile.x0; x < tile.x1; x++)
+            {
+                scorePixel(x - sx0, y - sy0, znccVals, tileLeft, tileRight, tileParams);
+
+                double maxZncc = -1.0;
+                int bestDisp = 0;
+                const int dispEnd = matchInside ? min(znccParams.maxDisp, x + 1) : znccParams.maxDisp;
+
+                for (int d = 0; d < dispEnd; d++)
+                {
+                    if (znccVals[d] > maxZncc)
+                    {
+                        maxZncc = znccVals[d];
+                        bestDisp = d;
+                    }
+                }
+
+                dispMap[y * znccParams.width + x] = static_cast<disp_t>(bestDisp);
+            }
+        } });
+
+    printSchedulerStats(stats);
+}
+
+// Rows reversed left to right
+template <typename T>
+vector<T> mirrorRows(const vector<T> &img, int width, int height)
+{
+    vector<T> mirrored(img.size());
+    for (int y = 0; y < height; y++)
+    {
+        reverse_copy(&img[y * width], &img[y * width] + width, &mirrored[y * width]);
+    }
+    return mirrored;
+}
+
+bool cacheTilingSupports(ZnccMethod method)
+{
+    switch (method)
+    {
+    case ZnccMethod::SINGLE_THREADED:
+    case ZnccMethod::MULTI_THREADED:
+    case ZnccMethod::OPENMP:
+#ifdef USE_SIMD
+    case ZnccMethod::SIMD:
+#endif
+    case ZnccMethod::SIMD_INTRINSICS:
+    case ZnccMethod::TEMPLATED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Both passes of the per-pixel methods through zncc_cache_tiled, returns false for the other methods. With
+// fusedLeftRight, the right map takes the convention of the fused paths, the right pixel x matching the left pixel
+// x + d: that is the x - d search of the right pass on both images mirrored, restricted to matches inside the image,
+// so the same tiled pass runs on those.
+bool zncc_cache_tiled(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    if (!cacheTilingSupports(znccParams.method))
+    {
+        cout << "# Cache tiling: not supported by " << ZnccMethodToString(znccParams.method) << ", untiled run" << endl;
+        return false;
+    }
+
+    auto runPasses = [&](auto scorePixel, bool rightDispHalo = false)
+    {
+        zncc_cache_tiled(leftDispMap, leftImg, rightImg, znccParams, scorePixel, rightDispHalo);
+        if (!znccParams.fusedLeftRight)
+        {
+            zncc_cache_tiled(rightDispMap, rightImg, leftImg, znccParams, scorePixel, rightDispHalo);
+            return true;
+        }
+
+        const int width = znccParams.width;
+        const int height = znccParams.height;
+        DispMap mirroredDispMap(rightDispMap.size());
+        zncc_cache_tiled(mirroredDispMap, mirrorRows(rightImg, width, height), mirrorRows(leftImg, width, height), znccParams, scorePixel, rightDispHalo, true);
+        rightDispMap = mirrorRows(mirroredDispMap, width, height);
+        return true;
+    };
+
+    switch (znccParams.method)
+    {
+    case ZnccMethod::SINGLE_THREADED:
+    case ZnccMethod::MULTI_THREADED:
+    case ZnccMethod::OPENMP:
+        return runPasses(score_pixel);
+#ifdef USE_SIMD
+    case ZnccMethod::SIMD:
+        return runPasses([](int x, int y, vector<double> &znccVals, const vector<unsigned char> &img1, const vector<unsigned char> &img2, const ZnccParams &params)
+                         {
+            if (params.precision == ZnccPrecision::INTEGER)
+            {
+                score_pixel_simd_int(x, y, znccVals, img1, img2, params);
+                return;
+            }
+
+            const int halfWinSize = params.winSize / 2;
+            double mean1 = calculateMeanSimd(x, y, params.width, params.height, halfWinSize, img1);
+            for (int d = 0; d < params.maxDisp; d++)
+            {
+                double mean2 = calculateMeanSimd(x - d, y, params.width, params.height, halfWinSize, img2);
+                znccVals[d] = calculateZnccSimd(x, y, d, mean1, mean2, params.width, params.height, halfWinSize, img1, img2);
+            } }, true);
+#endif
+    case ZnccMethod::SIMD_INTRINSICS:
+    {
+        const SimdKernels kernels = getSimdKernels(znccParams.simdIsa);
+        cout << "# SIMD kernels: " << SimdIsaToString(kernels.isa) << (intrinsicsWindowFits(znccParams.winSize) ? "" : ", int64 sums for winSize " + to_string(znccParams.winSize)) << endl;
+        return runPasses([&](int x, int y, vector<double> &znccVals, const vector<unsigned char> &img1, const vector<unsigned char> &img2, const ZnccParams &params)
+                         { score_pixel_intrinsics(x, y, znccVals, img1, img2, params, kernels); }, true);
+    }
+    case ZnccMethod::TEMPLATED:
+        return runPasses(getZnccScoreFn(znccParams.winSize, znccParams.maxDisp));
+    default:
+        return false;
+    }
+}
+
+void zncc_subpixel(vector<float> &leftSubDispMap, vector<float> &rightSubDispMap, const DispMap &leftDispMap, const DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool rightSearchesLeft)
+{
+    const int width = znccParams.width;
+    auto leftIntegral = buildIntegralImage(leftImg, width, znccParams.height);
+    auto rightIntegral = buildIntegralImage(rightImg, width, znccParams.height);
+
+    auto leftScore = [&](int x, int y, int d)
+    { return calculateZnccIntegral(x, y, d, leftImg, rightImg, leftIntegral, rightIntegral, znccParams); };
+    auto rightScore = [&](int x, int y, int d)
+    {
+        if (rightSearchesLeft)
+            return x + d < width ? leftScore(x + d, y, d) : -1.0;
+        return calculateZnccIntegral(x, y, d, rightImg, leftImg, rightIntegral, leftIntegral, znccParams);
+    };
+
+    auto fitMap = [&](vector<float> &subDispMap, const DispMap &dispMap, auto score)
+    {
+        subDispMap.resize(dispMap.size());
+#pragma omp parallel for schedule(dynamic)
+        for (int y = 0; y < znccParams.height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const int d = dispMap[y * width + x];
+                const double below = d > 0 ? score(x, y, d - 1) : NAN;
+                const double above = d + 1 < znccParams.maxDisp ? score(x, y, d + 1) : NAN;
+                subDispMap[y * width + x] = subPixelDisparity(d, below, score(x, y, d), above, znccParams.subPixel);
+            }
+        }
+    };
+
+    fitMap(leftSubDispMap, leftDispMap, leftScore);
+    fitMap(rightSubDispMap, rightDispMap, rightScore);
+}
+
+// Runs the method of znccParams, returns true when it also filled the sub-pixel maps from its argmax loops
+bool zncc_dispatch(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+    // cache tiling goes first, with fusedLeftRight it keeps the right map convention of the fused paths
+    if (znccParams.cacheTiling && zncc_cache_tiled(leftDispMap, rightDispMap, leftImg, rightImg, znccParams))
+        return false;
+
+    if (znccParams.fusedLeftRight && zncc_fused(leftDispMap, rightDispMap, leftImg, rightImg, znccParams, leftSubDispMap, rightSubDispMap))
+        return true;
 
     switch (znccParams.method)
     {
@@ -213,6 +1287,14 @@ void zncc(vector<unsigned char> &leftDispMap, vector<unsigned char> &rightDispMa
         zncc_simd(leftDispMap, leftImg, rightImg, znccParams);
         zncc_simd(rightDispMap, rightImg, leftImg, znccParams);
         break;
+    case ZnccMethod::SIMD_INTRINSICS:
+        zncc_simd_intrinsics(leftDispMap, leftImg, rightImg, znccParams);
+        zncc_simd_intrinsics(rightDispMap, rightImg, leftImg, znccParams);
+        break;
+    case ZnccMethod::TEMPLATED:
+        zncc_templated(leftDispMap, leftImg, rightImg, znccParams);
+        zncc_templated(rightDispMap, rightImg, leftImg, znccParams);
+        break;
     case ZnccMethod::OPENCL:
         zncc_opencl(leftDispMap, leftImg, rightImg, znccParams, false);
         zncc_opencl(rightDispMap, rightImg, leftImg, znccParams, true);
@@ -228,6 +1310,10 @@ void zncc(vector<unsigned char> &leftDispMap, vector<unsigned char> &rightDispMa
     case ZnccMethod::OPENCL_OPT3:
         zncc_opencl_opt3(leftDispMap, rightDispMap, leftImg, rightImg, znccParams);
         break;
+    case ZnccMethod::OPENCL_TILED:
+        zncc_opencl_tiled(leftDispMap, leftImg, rightImg, znccParams);
+        zncc_opencl_tiled(rightDispMap, rightImg, leftImg, znccParams);
+        break;
     // case ZnccMethod::OPENCL_PIPE:
     //     zncc_opencl_pipe(leftDispMap, leftImg, rightImg, znccParams);
     //     break;
@@ -235,7 +1321,59 @@ void zncc(vector<unsigned char> &leftDispMap, vector<unsigned char> &rightDispMa
         zncc_cuda(leftDispMap, leftImg, rightImg, znccParams);
         zncc_cuda(rightDispMap, rightImg, leftImg, znccParams);
         break;
+    case ZnccMethod::INTEGRAL:
+    {
+        // integral images are built once per input image and shared by both directions
+        auto leftIntegral = buildIntegralImage(leftImg, znccParams.width, znccParams.height);
+        auto rightIntegral = buildIntegralImage(rightImg, znccParams.width, znccParams.height);
+        zncc_integral(leftDispMap, leftImg, rightImg, leftIntegral, rightIntegral, znccParams);
+        zncc_integral(rightDispMap, rightImg, leftImg, rightIntegral, leftIntegral, znccParams);
+        break;
     }
+    case ZnccMethod::SLIDING_WINDOW:
+        zncc_sliding(leftDispMap, leftImg, rightImg, znccParams, nullptr, leftSubDispMap);
+        zncc_sliding(rightDispMap, rightImg, leftImg, znccParams, nullptr, rightSubDispMap);
+        return true;
+    case ZnccMethod::COST_VOLUME:
+    {
+        auto leftIntegral = buildIntegralImage(leftImg, znccParams.width, znccParams.height);
+        auto rightIntegral = buildIntegralImage(rightImg, znccParams.width, znccParams.height);
+        zncc_cost_volume(leftDispMap, leftImg, rightImg, leftIntegral, rightIntegral, znccParams, nullptr, leftSubDispMap);
+        zncc_cost_volume(rightDispMap, rightImg, leftImg, rightIntegral, leftIntegral, znccParams, nullptr, rightSubDispMap);
+        return true;
+    }
+    }
+    return false;
+}
+
+// ZNCC wrapper function
+void zncc(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap, vector<float> *rightSubDispMap)
+{
+    #ifndef USE_OCL
+    if (znccParams.method == ZnccMethod::OPENCL || znccParams.method == ZnccMethod::OPENCL_OPT || znccParams.method == ZnccMethod::OPENCL_TILED)
+    {
+        cout << "OpenCL not enabled" << endl;
+        return;
+    }
+    #endif
+
+    if (!dispRangeFits(znccParams) || !boundedSearchFits(znccParams))
+        return;
+
+    // The fused, sliding-window and cost-volume paths fill the sub-pixel maps in their argmax loops
+    const bool subPixel = leftSubDispMap && rightSubDispMap && znccParams.subPixel != SubPixelFit::NONE;
+    if (subPixel)
+    {
+        leftSubDispMap->assign(leftDispMap.size(), 0.0f);
+        rightSubDispMap->assign(rightDispMap.size(), 0.0f);
+    }
+
+    if (zncc_dispatch(leftDispMap, rightDispMap, leftImg, rightImg, znccParams, subPixel ? leftSubDispMap : nullptr, subPixel ? rightSubDispMap : nullptr) || !subPixel)
+        return;
+
+    // the reversed OpenCL kernels search the right map in the left image, like the fused paths and cache tiling with them
+    const bool rightSearchesLeft = znccParams.method == ZnccMethod::OPENCL || znccParams.method == ZnccMethod::OPENCL_OPT || (znccParams.cacheTiling && znccParams.fusedLeftRight && cacheTilingSupports(znccParams.method));
+    zncc_subpixel(*leftSubDispMap, *rightSubDispMap, leftDispMap, rightDispMap, leftImg, rightImg, znccParams, rightSearchesLeft);
 }
 
 // ZNCC pipeline
@@ -243,16 +1381,31 @@ ZnccResult zncc_pipeline(const vector<unsigned char> &leftImg, const vector<unsi
 {
     int numPixels = znccParams.width * znccParams.height;
     ZnccResult znccResult;
-    znccResult.dispMap = vector<unsigned char>(numPixels);
-    znccResult.dispMapLeft = vector<unsigned char>(numPixels);
-    znccResult.dispMapRight = vector<unsigned char>(numPixels);
+    znccResult.dispMap = DispMap(numPixels);
+    znccResult.dispMapLeft = DispMap(numPixels);
+    znccResult.dispMapRight = DispMap(numPixels);
 
+    if (!dispRangeFits(znccParams) || !boundedSearchFits(znccParams))
+        return znccResult;
+
+#ifdef USE_OCL
+    // OPENCL_TILED can leave its maps on the device for post_proc_pipeline, the host path runs if it cannot
+    if (znccParams.postProcOnDevice && znccParams.method == ZnccMethod::OPENCL_TILED && znccParams.subPixel == SubPixelFit::NONE)
+    {
+        cout << "## ZNCC on the OpenCL device ...\n";
+        Timer timer;
+        znccResult.deviceMaps = zncc_opencl_device_maps(znccResult.dispMapLeft, znccResult.dispMapRight, leftImg, rightImg, znccParams);
+        znccResult.znccTime = timer.getDuration();
+        if (znccResult.deviceMaps)
+            return znccResult;
+    }
+#endif
 
     // Compute the disparity map using ZNCC
     cout << "## ZNCC ...\n";
     {
         Timer timer;
-        zncc(znccResult.dispMapLeft, znccResult.dispMapRight, leftImg, rightImg, znccParams);
+        zncc(znccResult.dispMapLeft, znccResult.dispMapRight, leftImg, rightImg, znccParams, &znccResult.dispMapLeftSubPixel, &znccResult.dispMapRightSubPixel);
         znccResult.znccTime = timer.getDuration();
     }
 
@@ -261,6 +1414,15 @@ ZnccResult zncc_pipeline(const vector<unsigned char> &leftImg, const vector<unsi
 
 void post_proc_pipeline(ZnccResult &result, ZnccParams &params)
 {
+#ifdef USE_OCL
+    if (result.deviceMaps)
+    {
+        cout << "## Postprocessing on the OpenCL device ...\n";
+        result.postProcTime = post_proc_opencl(*result.deviceMaps, result.dispMap, result.dispMapLeft, result.dispMapRight, result.dispMapCC, result.dispMapOC, params);
+        return;
+    }
+#endif
+
     cout << "## Postprocessing ...\n";
     {
         Timer timer;
@@ -271,6 +1433,16 @@ void post_proc_pipeline(ZnccResult &result, ZnccParams &params)
         // Apply occlusion filling if enabled
         result.dispMapOC = params.withOcclusionFilling ? fillOcclusion(result.dispMapCC, params) : result.dispMapCC;
 
+        // Sub-pixel disparities where the left map survived cross-checking, the filled values elsewhere
+        if (!result.dispMapLeftSubPixel.empty())
+        {
+            result.dispMapSubPixel.resize(result.dispMapOC.size());
+            for (size_t i = 0; i < result.dispMapOC.size(); i++)
+            {
+                result.dispMapSubPixel[i] = result.dispMapOC[i] == result.dispMapLeft[i] ? result.dispMapLeftSubPixel[i] : result.dispMapOC[i];
+            }
+        }
+
         // Normalize the disparity map if enabled
         if(params.withNormalization)
         {
@@ -17,35 +17,66 @@
 #include <atomic>
 #include <mutex>
 #include <map>
+#include <memory>
 #include <omp.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 #include "../utils/scope_based_timer.hpp"
+#include "../utils/tile_scheduler.hpp"
 #include "zncc_common.hpp"
+#include "zncc_intrinsics.hpp"
+#include "zncc_templated.hpp"
 
 using namespace std;
 
 extern mutex cout_mutex;
 
+// Work of the bounded disparity search of INTEGRAL, summed over all calls since the start of the process
+struct BoundedSearchStats
+{
+    long long candidates = 0;
+    long long abandoned = 0; // candidates dropped before their last window row
+    long long rowsEvaluated = 0; // window rows whose cross term was summed
+    long long rowsTotal = 0; // window rows of all candidates, the work without the bound
+};
+
+BoundedSearchStats getBoundedSearchStats();
+void printBoundedSearchStats(const BoundedSearchStats &stats);
+
+// Maps kept on the OpenCL device by zncc_opencl_device_maps, opaque outside of USE_OCL builds
+struct OpenclDisparityMaps;
+
 struct ZnccResult
 {
-    vector<unsigned char> dispMapLeft;
-    vector<unsigned char> dispMapRight;
-    vector<unsigned char> dispMapCC;
-    vector<unsigned char> dispMapOC;
-    vector<unsigned char> dispMap;
+    DispMap dispMapLeft;
+    DispMap dispMapRight;
+    DispMap dispMapCC;
+    DispMap dispMapOC;
+    DispMap dispMap;
     long long znccTime;
     long long postProcTime;
+    shared_ptr<OpenclDisparityMaps> deviceMaps; // set while the maps of OPENCL_TILED are kept on the device
+    vector<float> dispMapLeftSubPixel; // with params.subPixel, the left and right maps with their fitted offsets
+    vector<float> dispMapRightSubPixel;
+    vector<float> dispMapSubPixel; // post-processed, not normalized
 };
 
-// void zncc_single(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
-// void zncc_multi(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
-// void zncc_openmp(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
-// void zncc_simd(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
-// void zncc_opencl(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
-// void zncc_opencl_opt(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
-// void zncc_opencl_pipe(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
-// void zncc_cuda(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+// void zncc_single(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+// void zncc_multi(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+// void zncc_openmp(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+// void zncc_simd(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+// void zncc_opencl(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+// void zncc_opencl_opt(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+// void zncc_opencl_pipe(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+// void zncc_cuda(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+
+// The sub-pixel maps are filled when given and znccParams.subPixel is set
+void zncc(DispMap& leftDispMap, DispMap& rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, vector<float> *leftSubDispMap = nullptr, vector<float> *rightSubDispMap = nullptr);
 
-void zncc(vector<unsigned char>& leftDispMap, vector<unsigned char>& rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+// Sub-pixel maps fitted to scores at d - 1, d and d + 1 recomputed on integral images, for the methods without a fit
+// in their argmax loops. rightSearchesLeft is the convention of the fused paths, the right pixel x matching x + d.
+void zncc_subpixel(vector<float> &leftSubDispMap, vector<float> &rightSubDispMap, const DispMap &leftDispMap, const DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool rightSearchesLeft);
 ZnccResult zncc_pipeline(const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
 
 void post_proc_pipeline(ZnccResult &result, ZnccParams &params);
@@ -0,0 +1,224 @@
+#include "zncc_batch.hpp"
+
+namespace fs = filesystem;
+
+// Inputs with these extensions are picked up, PNG first when a pair comes in several formats
+const vector<string> imageExtensions = {".png", ".pgm", ".raw"};
+
+vector<StereoPairPath> findStereoPairs(const string &root)
+{
+    vector<StereoPairPath> pairs;
+    const fs::path rootPath(root);
+
+    // Numbered frames sort by length first, so frame_10 comes after frame_9
+    auto byNumber = [](const string &a, const string &b)
+    { return a.size() != b.size() ? a.size() < b.size() : a < b; };
+
+    if (fs::is_directory(rootPath / "left") && fs::is_directory(rootPath / "right"))
+    {
+        for (auto &entry : fs::directory_iterator(rootPath / "left"))
+        {
+            auto rightPath = rootPath / "right" / entry.path().filename();
+            auto extension = entry.path().extension().string();
+            if (find(imageExtensions.begin(), imageExtensions.end(), extension) != imageExtensions.end() && fs::exists(rightPath))
+                pairs.push_back({entry.path().stem().string(), entry.path().string(), rightPath.string()});
+        }
+        sort(pairs.begin(), pairs.end(), [&](const StereoPairPath &a, const StereoPairPath &b)
+             { return byNumber(a.name, b.name); });
+        return pairs;
+    }
+
+    auto addPair = [&](const fs::path &dir)
+    {
+        for (const auto &extension : imageExtensions)
+        {
+            auto leftPath = dir / ("im0" + extension);
+            auto rightPath = dir / ("im1" + extension);
+            if (!fs::exists(leftPath) || !fs::exists(rightPath))
+                continue;
+            auto name = dir == rootPath ? fs::weakly_canonical(dir).filename().string() : fs::relative(dir, rootPath).generic_string();
+            replace(name.begin(), name.end(), '/', '_');
+            pairs.push_back({name, leftPath.string(), rightPath.string()});
+            return;
+        }
+    };
+
+    addPair(rootPath);
+    for (auto &entry : fs::recursive_directory_iterator(rootPath))
+    {
+        if (entry.is_directory())
+            addPair(entry.path());
+    }
+    sort(pairs.begin(), pairs.end(), [](const StereoPairPath &a, const StereoPairPath &b)
+         { return a.name < b.name; });
+
+    return pairs;
+}
+
+// A stereo pair on its way through the stages, a failed stage marks it and the later ones pass it on
+struct BatchJob
+{
+    StereoPairPath pair;
+    bool ok = true;
+    Image left;
+    Image right;
+    vector<unsigned char> leftImg;
+    vector<unsigned char> rightImg;
+    ZnccParams params;
+    ZnccResult result;
+};
+
+vector<StageStats> zncc_batch(const vector<StereoPairPath> &pairs, const ZnccParams &znccParams, const string &outDir, size_t queueCapacity, const string &outFormat)
+{
+    fs::create_directories(outDir);
+    ofstream csvLog(outDir + "/batch.csv");
+    csvLog << "name,width,height,method,winSize,maxDisp,znccTime,postprocTime\n";
+
+    const int resizeFactor = znccParams.resizeFactor;
+    const string outExtension = outFormat == "raw" ? ".raw" : ".png";
+    vector<function<void(BatchJob &)>> stages = {
+        // decode
+        [](BatchJob &job)
+        {
+            bool err;
+            tie(err, job.left) = loadImage(job.pair.leftPath, false);
+            if (!err)
+                tie(err, job.right) = loadImage(job.pair.rightPath, false);
+            job.ok = !err;
+        },
+        // grey/downsample
+        [&](BatchJob &job)
+        {
+            const int width = job.left.width;
+            const int height = job.left.height;
+            if (job.right.width != job.left.width || job.right.height != job.left.height)
+            {
+                cout << "# " << job.pair.name << ": left and right images differ in size, skipped\n";
+                job.ok = false;
+                return;
+            }
+
+            // PGM and raw inputs are decoded straight to grey, RGBA ones are converted and downsampled in one pass
+            auto toGray = [&](Image &img)
+            {
+                if (!img.dataGray.empty())
+                    return resizeFactor != 1 ? downsample(img.dataGray, width, height, resizeFactor) : move(img.dataGray);
+                auto gray = rgbaToGrayDownsample(img.dataRgb, width, height, resizeFactor);
+                img.dataRgb = {};
+                return gray;
+            };
+            job.leftImg = toGray(job.left);
+            job.rightImg = toGray(job.right);
+            job.params.width = width / resizeFactor;
+            job.params.height = height / resizeFactor;
+        },
+        // zncc
+        [](BatchJob &job)
+        {
+            job.result = job.params.pyramidLevels > 1 ? zncc_pyramid_pipeline(job.leftImg, job.rightImg, job.params) : zncc_pipeline(job.leftImg, job.rightImg, job.params);
+            job.leftImg = {};
+            job.rightImg = {};
+        },
+        // post-processing
+        [](BatchJob &job)
+        {
+            post_proc_pipeline(job.result, job.params);
+        },
+        // encode
+        [&](BatchJob &job)
+        {
+            const auto &params = job.params;
+            saveImage(outDir + "/" + job.pair.name + "_disp" + outExtension, job.result.dispMap, params.width, params.height);
+            if (!job.result.dispMapLeft.empty())
+            {
+                saveImage(outDir + "/" + job.pair.name + "_left" + outExtension, job.result.dispMapLeft, params.width, params.height);
+                saveImage(outDir + "/" + job.pair.name + "_right" + outExtension, job.result.dispMapRight, params.width, params.height);
+            }
+            if (!job.result.dispMapSubPixel.empty())
+                saveDisparityRaw(outDir + "/" + job.pair.name + "_disp_subpx.raw", subPixelToFixed(job.result.dispMapSubPixel, static_cast<float>(params.resizeFactor)), params.width, params.height);
+            csvLog << job.pair.name << "," << params.width << "," << params.height << "," << ZnccMethodToString(params.method) << "," << params.winSize << "," << params.maxDisp << ","
+                   << job.result.znccTime << "," << job.result.postProcTime << "\n";
+        },
+    };
+
+    vector<StageStats> stats(stages.size());
+    for (auto [s, name] : {make_pair(0, "decode"), make_pair(1, "grey/downsample"), make_pair(2, "zncc"), make_pair(3, "post-processing"), make_pair(4, "encode")})
+        stats[s].name = name;
+
+    // queues[s] connects stage s to stage s + 1
+    vector<unique_ptr<SpscQueue<unique_ptr<BatchJob>>>> queues;
+    for (size_t s = 0; s + 1 < stages.size(); s++)
+        queues.push_back(make_unique<SpscQueue<unique_ptr<BatchJob>>>(queueCapacity));
+
+    auto runStage = [&](size_t s)
+    {
+        auto elapsedUs = [](chrono::high_resolution_clock::time_point from, chrono::high_resolution_clock::time_point to)
+        { return chrono::duration_cast<chrono::microseconds>(to - from).count(); };
+        size_t nextPair = 0;
+
+        while (true)
+        {
+            auto waitStart = chrono::high_resolution_clock::now();
+            unique_ptr<BatchJob> job;
+            if (s == 0)
+            {
+                if (nextPair == pairs.size())
+                    break;
+                job = make_unique<BatchJob>();
+                job->pair = pairs[nextPair++];
+                job->params = znccParams;
+            }
+            else
+            {
+                auto item = queues[s - 1]->pop();
+                if (!item)
+                    break;
+                job = move(*item);
+            }
+
+            auto busyStart = chrono::high_resolution_clock::now();
+            if (job->ok)
+            {
+                stages[s](*job);
+                stats[s].items++;
+            }
+            auto busyEnd = chrono::high_resolution_clock::now();
+
+            if (s < queues.size())
+                queues[s]->push(move(job));
+
+            stats[s].busyUs += elapsedUs(busyStart, busyEnd);
+            stats[s].waitUs += elapsedUs(waitStart, busyStart) + elapsedUs(busyEnd, chrono::high_resolution_clock::now());
+        }
+
+        if (s < queues.size())
+            queues[s]->close();
+    };
+
+    cout << "## Batch of " << pairs.size() << " stereo pairs into " << outDir << "\n";
+    auto start = chrono::high_resolution_clock::now();
+
+    vector<thread> threads;
+    for (size_t s = 0; s < stages.size(); s++)
+        threads.emplace_back(runStage, s);
+    for (auto &th : threads)
+        th.join();
+
+    printStageStats(stats, chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count());
+    return stats;
+}
+
+void printStageStats(const vector<StageStats> &stats, long long elapsedUs)
+{
+    const StageStats *bottleneck = nullptr;
+    for (const auto &stage : stats)
+    {
+        cout << "# Stage " << stage.name << ": " << stage.items << " items, busy " << stage.busyUs << " us ("
+             << fixed << setprecision(2) << (stage.busyUs > 0 ? stage.items * 1e6 / stage.busyUs : 0.0) << " items/s), waiting " << stage.waitUs << " us" << endl;
+        if (!bottleneck || stage.busyUs > bottleneck->busyUs)
+            bottleneck = &stage;
+    }
+
+    if (bottleneck)
+        cout << "# Batch: " << elapsedUs << " us, bottleneck " << bottleneck->name << " busy " << fixed << setprecision(1) << (elapsedUs > 0 ? 100.0 * bottleneck->busyUs / elapsedUs : 0.0) << " % of the time" << endl;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <filesystem>
+#include "../utils/datatools.hpp"
+#include "../utils/spsc_queue.hpp"
+#include "zncc.hpp"
+#include "zncc_pyramid.hpp"
+
+using namespace std;
+
+// One stereo pair of a batch, named after its directory or its frame file
+struct StereoPairPath
+{
+    string name;
+    string leftPath;
+    string rightPath;
+};
+
+// Items and time of one pipeline stage, waiting covers both an empty input and a full output queue
+struct StageStats
+{
+    string name;
+    int items = 0;
+    long long busyUs = 0;
+    long long waitUs = 0;
+};
+
+// Middlebury pairs, directories holding im0 and im1 as .png, .pgm or .raw, anywhere under root. A sequence directory
+// with left/ and right/ subdirectories gives one pair per frame, matched by file name in sorted order.
+vector<StereoPairPath> findStereoPairs(const string &root);
+
+// Runs decode -> grey/downsample -> ZNCC -> post-processing -> encode as concurrent stages, one thread each,
+// connected by bounded lock-free queues of queueCapacity pairs. The width and height of znccParams are set
+// per pair from its images and resizeFactor. Disparity maps, as png or as raw files skipping the encoding, and
+// batch.csv are written to outDir. With znccParams.subPixel, <name>_disp_subpx.raw holds the post-processed map as
+// uint16 in 1/16 pixel steps of the full-resolution image.
+vector<StageStats> zncc_batch(const vector<StereoPairPath> &pairs, const ZnccParams &znccParams, const string &outDir, size_t queueCapacity = 2, const string &outFormat = "png");
+
+void printStageStats(const vector<StageStats> &stats, long long elapsedUs);
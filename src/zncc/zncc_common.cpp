@@ -6,6 +6,44 @@ string ZnccMethodToString(ZnccMethod method)
     return it != ZnccString.end() ? it->second : "unknown";	
 }
 
+string SimdIsaToString(SimdIsa isa)
+{
+    auto it = SimdIsaString.find(isa);
+    return it != SimdIsaString.end() ? it->second : "unknown";
+}
+
+float subPixelDisparity(int bestDisp, double below, double best, double above, SubPixelFit fit)
+{
+    if (fit == SubPixelFit::NONE || isnan(below) || isnan(above))
+        return static_cast<float>(bestDisp);
+
+    double offset = 0.0;
+    if (fit == SubPixelFit::PARABOLA)
+    {
+        const double curvature = below - 2.0 * best + above;
+        if (curvature < 0.0)
+            offset = (below - above) / (2.0 * curvature);
+    }
+    else
+    {
+        const double slope = max(best - below, best - above);
+        if (slope > 0.0)
+            offset = (above - below) / (2.0 * slope);
+    }
+
+    return static_cast<float>(bestDisp + clamp(offset, -0.5, 0.5));
+}
+
+vector<uint16_t> subPixelToFixed(const vector<float> &dispMap, float scale)
+{
+    vector<uint16_t> fixedMap(dispMap.size());
+    for (size_t i = 0; i < dispMap.size(); i++)
+    {
+        fixedMap[i] = static_cast<uint16_t>(clamp(lround(dispMap[i] * scale * 16.0f), 0L, 65535L));
+    }
+    return fixedMap;
+}
+
 double calculateMean(int x, int y, const vector<unsigned char> &img, const ZnccParams &znccParams)
 {
     const int numPixels = znccParams.winSize * znccParams.winSize;
@@ -119,95 +157,276 @@ double calculateZnccSimd(int x, int y, int d, double mean1, double mean2, int wi
     return denom == 0.0 ? 0.0 : num / denom;
 }
 
-vector<unsigned char> crosscheck(const vector<unsigned char> &dispMapLeft, const vector<unsigned char> &dispMapRight, const ZnccParams &znccParams)
+IntegralImage buildIntegralImage(const vector<unsigned char> &img, int width, int height)
 {
-    cout << "## Cross checking\n";
-    vector<unsigned char> result(dispMapLeft);
+    const int stride = width + 1;
+    IntegralImage integral{width, height, vector<long long>(stride * (height + 1), 0), vector<long long>(stride * (height + 1), 0)};
 
-    // Loop over all pixels
-#pragma omp parallel for schedule(dynamic)
-    for (int idx = 0; idx < znccParams.width * znccParams.height; idx++)
+    for (int y = 0; y < height; y++)
     {
-        int y = idx / znccParams.width;
-        int x = idx % znccParams.width;
-
-        // Get the disparities from both depth maps
-        int dispLeft = dispMapLeft[idx];
-        if (idx - dispLeft < 0)
-            continue;
-        int dispRight = dispMapRight[idx - dispLeft];
-
-        // Check if the disparities match
-        // if (x - dispLeft >= 0 && x - dispLeft < width && abs(dispRight - dispMapLeft[idx - dispLeft]) <= CC_THRESHOLD)
-        if (abs(dispRight - dispLeft) > znccParams.ccThresh)
+        long long rowSum = 0;
+        long long rowSqSum = 0;
+        for (int x = 0; x < width; x++)
         {
-            result[idx] = 0;
+            long long val = img[y * width + x];
+            rowSum += val;
+            rowSqSum += val * val;
+            integral.sum[(y + 1) * stride + x + 1] = integral.sum[y * stride + x + 1] + rowSum;
+            integral.sqSum[(y + 1) * stride + x + 1] = integral.sqSum[y * stride + x + 1] + rowSqSum;
         }
     }
 
-    return result;
+    return integral;
 }
 
-vector<unsigned char> fillOcclusion(const vector<unsigned char> &dispMap, const ZnccParams &znccParams)
+// Sum over [x0, x1) x [y0, y1) of an integral table built for an image of the given width
+long long integralSum(const vector<long long> &table, int width, int x0, int y0, int x1, int y1)
 {
-    cout << "## Occlusion filling\n";
-    vector<unsigned char> result(dispMap);
+    const int stride = width + 1;
+    return table[y1 * stride + x1] - table[y0 * stride + x1] - table[y1 * stride + x0] + table[y0 * stride + x0];
+}
 
-    // Loop over all pixels
-#pragma omp parallel for schedule(dynamic)
-    for (int idx = 0; idx < znccParams.width * znccParams.height; idx++)
-    {
-        int y = idx / znccParams.width;
-        int x = idx % znccParams.width;
+// Same result as calculateZncc, but from window sums: the means may come from windows larger
+// than the overlap (image borders), so everything is scaled by the mean counts to stay in integers
+double calculateZnccFromSums(const ZnccSums &sums, long long meanSum1, long long meanCount1, long long meanSum2, long long meanCount2)
+{
+    if (sums.count == 0)
+        return 0.0;
 
-        // Get the disparity value for this pixel
-        int disp = dispMap[idx];
+    long long num = meanCount1 * meanCount2 * sums.crossSum - meanSum2 * meanCount1 * sums.sum1 - meanSum1 * meanCount2 * sums.sum2 + sums.count * meanSum1 * meanSum2;
+    long long denom1 = meanCount1 * meanCount1 * sums.sqSum1 - 2 * meanSum1 * meanCount1 * sums.sum1 + sums.count * meanSum1 * meanSum1;
+    long long denom2 = meanCount2 * meanCount2 * sums.sqSum2 - 2 * meanSum2 * meanCount2 * sums.sum2 + sums.count * meanSum2 * meanSum2;
 
-        // If the disparity value is zero, this pixel is occluded
-        if (disp == 0)
+    double denom = sqrt(static_cast<double>(denom1) * static_cast<double>(denom2));
+    return denom == 0.0 ? 0.0 : num / denom;
+}
+
+// Score of a single disparity from integral images, same result as calculateZncc
+double calculateZnccIntegral(int x, int y, int d, const vector<unsigned char> &img1, const vector<unsigned char> &img2, const IntegralImage &integral1, const IntegralImage &integral2, const ZnccParams &znccParams)
+{
+    const int width = znccParams.width;
+    const int halfWinSize = znccParams.winSize / 2;
+    int y0 = max(0, y - halfWinSize);
+    int y1 = min(znccParams.height, y + halfWinSize + 1);
+    int x0 = max(0, x - halfWinSize);
+    int x1 = min(width, x + halfWinSize + 1);
+
+    long long meanCount1 = (x1 - x0) * (y1 - y0);
+    long long meanSum1 = integralSum(integral1.sum, width, x0, y0, x1, y1);
+
+    // window of the second image mean, centered at x - d
+    int xm0 = max(0, x - d - halfWinSize);
+    int xm1 = min(width, x - d + halfWinSize + 1);
+    long long meanCount2 = max(0, xm1 - xm0) * (y1 - y0);
+    long long meanSum2 = meanCount2 > 0 ? integralSum(integral2.sum, width, xm0, y0, xm1, y1) : 0;
+
+    // overlap of both windows, in first image coordinates
+    int xs0 = max(x0, d);
+    ZnccSums sums{0, 0, 0, 0, 0, 0};
+    if (x1 > xs0)
+    {
+        sums.count = (x1 - xs0) * (y1 - y0);
+        sums.sum1 = integralSum(integral1.sum, width, xs0, y0, x1, y1);
+        sums.sqSum1 = integralSum(integral1.sqSum, width, xs0, y0, x1, y1);
+        sums.sum2 = integralSum(integral2.sum, width, xs0 - d, y0, x1 - d, y1);
+        sums.sqSum2 = integralSum(integral2.sqSum, width, xs0 - d, y0, x1 - d, y1);
+
+        for (int yy = y0; yy < y1; yy++)
         {
-            // Search for the nearest non-occluded pixel in the same row
-            int left = x;
-            int right = x;
-            while (left >= 0 && dispMap[y * znccParams.width + left] == 0)
+            const unsigned char *row1 = &img1[yy * width];
+            const unsigned char *row2 = &img2[yy * width];
+            int crossSum = 0;
+            for (int xx = xs0; xx < x1; xx++)
             {
-                left--;
-            }
-            while (right < znccParams.width && dispMap[y * znccParams.width + right] == 0)
-            {
-                right++;
+                crossSum += row1[xx] * row2[xx - d];
             }
+            sums.crossSum += crossSum;
+        }
+    }
 
-            // Calculate a new disparity value as the average of the two nearest non-occluded pixels
-            auto idx_left = max(0, y * znccParams.width + left);
-            auto idx_right = min(znccParams.width - 1, y * znccParams.width + right);
-            auto new_disp = (dispMap[idx_left] + dispMap[idx_right]) / 2;
+    return calculateZnccFromSums(sums, meanSum1, meanCount1, meanSum2, meanCount2);
+}
 
-            // Clamp the new disparity value to the valid range
-            // new_disp = max(0, min(znccParams.maxDisp, new_disp));
+// Integer counterpart of calculateMeanSimd, returns the window sum and pixel count.
+// Each row is summed in int32 lanes and added to a 64-bit total, so only one row has to fit in int32.
+tuple<long long, long long> calculateSumSimdInt(int x, int y, int width, int height, int halfWinSize, const vector<unsigned char> &img)
+{
+    int yy_0 = max(0, y - halfWinSize);
+    int yy_1 = min(height, y + halfWinSize + 1);
+    int xx_0 = max(0, x - halfWinSize);
+    int xx_1 = min(width, x + halfWinSize + 1);
+
+    if (xx_1 <= xx_0 || yy_1 <= yy_0)
+        return make_tuple(0LL, 0LL);
 
-            result[idx] = static_cast<unsigned char>(new_disp);
+    long long sum = 0;
+    for (int yy = yy_0; yy < yy_1; yy++)
+    {
+        const unsigned char *row = &img[yy * width];
+        int rowSum = 0;
+#ifdef USE_SIMD
+#pragma omp simd reduction(+:rowSum)
+#endif
+        for (int xx = xx_0; xx < xx_1; xx++)
+        {
+            rowSum += row[xx];
         }
+        sum += rowSum;
     }
 
-    return result;
+    return make_tuple(sum, static_cast<long long>(xx_1 - xx_0) * (yy_1 - yy_0));
 }
 
-vector<unsigned char> normalizeMap(const vector<unsigned char> &dispMap, const ZnccParams &znccParams)
+// Integer counterpart of calculateZnccSimd, same window ranges, the score comes from calculateZnccFromSums.
+// The row sums are int32 and the window totals 64-bit: a row of squares, 255^2 per pixel, stays exact up to
+// 33025 pixels, the window size does not matter. The 181x181 limit of the intrinsics kernels comes from their
+// whole-window int32 squared sum instead.
+ZnccSums calculateZnccSumsSimdInt(int x, int y, int d, int width, int height, int halfWinSize, const vector<unsigned char> &img1, const vector<unsigned char> &img2)
 {
-    cout << "## Map Normalization\n";
-    vector<unsigned char> normalizedMap = dispMap;
+    int yy_0 = max(0, y - halfWinSize);
+    int yy_1 = min(height, y + halfWinSize + 1);
+    int xx_0 = max(d, x - halfWinSize);
+    int xx_1 = min(width - d, x + halfWinSize + 1);
+
+    ZnccSums sums{0, 0, 0, 0, 0, 0};
+    if (xx_1 <= xx_0 || yy_1 <= yy_0)
+        return sums;
 
-#pragma omp parallel for schedule(dynamic)
-    for (int idx = 0; idx < znccParams.width * znccParams.height; idx++)
+    for (int yy = yy_0; yy < yy_1; yy++)
     {
-        normalizedMap[idx] = static_cast<unsigned char>(dispMap[idx] * 255.0 / znccParams.maxDisp);
+        const unsigned char *row1 = &img1[yy * width];
+        const unsigned char *row2 = &img2[yy * width];
+        int sum1 = 0, sum2 = 0, sqSum1 = 0, sqSum2 = 0, crossSum = 0;
+#ifdef USE_SIMD
+#pragma omp simd reduction(+:sum1, sum2, sqSum1, sqSum2, crossSum)
+#endif
+        for (int xx = xx_0; xx < xx_1; xx++)
+        {
+            int val1 = row1[xx];
+            int val2 = row2[xx - d];
+            sum1 += val1;
+            sum2 += val2;
+            sqSum1 += val1 * val1;
+            sqSum2 += val2 * val2;
+            crossSum += val1 * val2;
+        }
+        sums.sum1 += sum1;
+        sums.sum2 += sum2;
+        sums.sqSum1 += sqSum1;
+        sums.sqSum2 += sqSum2;
+        sums.crossSum += crossSum;
     }
+    sums.count = static_cast<long long>(xx_1 - xx_0) * (yy_1 - yy_0);
+
+    return sums;
+}
+
+bool dispRangeFits(const ZnccParams &znccParams)
+{
+    if (znccParams.maxDisp <= MAX_DISP_RANGE)
+        return true;
+
+    cout << "maxDisp " << znccParams.maxDisp << " does not fit in " << 8 * sizeof(disp_t) << "-bit disparity maps, build with USE_DISP16" << endl;
+    return false;
+}
+
+bool boundedSearchFits(const ZnccParams &znccParams)
+{
+    if (!znccParams.boundedSearch || (znccParams.method == ZnccMethod::INTEGRAL && !znccParams.fusedLeftRight))
+        return true;
+
+    cout << "boundedSearch is only supported by INTEGRAL without fusedLeftRight, not by " << ZnccMethodToString(znccParams.method) << (znccParams.fusedLeftRight ? " with fusedLeftRight" : "") << endl;
+    return false;
+}
+
+DispMap crosscheck(const DispMap &dispMapLeft, const DispMap &dispMapRight, const ZnccParams &znccParams)
+{
+    cout << "## Cross checking\n";
+    DispMap result(dispMapLeft);
 
-    // for (auto &val : normalizedMap)
-    // {
-    //     val = static_cast<unsigned char>(val * 255.0 / znccParams.maxDisp);
-    // }
+    // Loop over all pixels
+    ThreadPool::getInstance().parallelFor(0, znccParams.width * znccParams.height, [&](int i0, int i1)
+                                          {
+        for (int idx = i0; idx < i1; idx++)
+        {
+            int y = idx / znccParams.width;
+            int x = idx % znccParams.width;
+
+            // Get the disparities from both depth maps
+            int dispLeft = dispMapLeft[idx];
+            if (idx - dispLeft < 0)
+                continue;
+            int dispRight = dispMapRight[idx - dispLeft];
+
+            // Check if the disparities match
+            // if (x - dispLeft >= 0 && x - dispLeft < width && abs(dispRight - dispMapLeft[idx - dispLeft]) <= CC_THRESHOLD)
+            if (abs(dispRight - dispLeft) > znccParams.ccThresh)
+            {
+                result[idx] = 0;
+            }
+        } });
+
+    return result;
+}
+
+DispMap fillOcclusion(const DispMap &dispMap, const ZnccParams &znccParams)
+{
+    cout << "## Occlusion filling\n";
+    DispMap result(dispMap);
+
+    // Loop over all pixels
+    ThreadPool::getInstance().parallelFor(0, znccParams.width * znccParams.height, [&](int i0, int i1)
+                                          {
+        for (int idx = i0; idx < i1; idx++)
+        {
+            int y = idx / znccParams.width;
+            int x = idx % znccParams.width;
+
+            // Get the disparity value for this pixel
+            int disp = dispMap[idx];
+
+            // If the disparity value is zero, this pixel is occluded
+            if (disp == 0)
+            {
+                // Search for the nearest non-occluded pixel in the same row
+                int left = x;
+                int right = x;
+                while (left >= 0 && dispMap[y * znccParams.width + left] == 0)
+                {
+                    left--;
+                }
+                while (right < znccParams.width && dispMap[y * znccParams.width + right] == 0)
+                {
+                    right++;
+                }
+
+                // Calculate a new disparity value as the average of the two nearest non-occluded pixels
+                auto idx_left = max(0, y * znccParams.width + left);
+                auto idx_right = min(znccParams.width - 1, y * znccParams.width + right);
+                auto new_disp = (dispMap[idx_left] + dispMap[idx_right]) / 2;
+
+                // Clamp the new disparity value to the valid range
+                // new_disp = max(0, min(znccParams.maxDisp, new_disp));
+
+                result[idx] = static_cast<disp_t>(new_disp);
+            }
+        } });
+
+    return result;
+}
+
+DispMap normalizeMap(const DispMap &dispMap, const ZnccParams &znccParams)
+{
+    cout << "## Map Normalization\n";
+    DispMap normalizedMap = dispMap;
+
+    // multiplied before dividing, as normalize_kernel does, so both truncate the same way
+    ThreadPool::getInstance().parallelFor(0, znccParams.width * znccParams.height, [&](int i0, int i1)
+                                          {
+        for (int idx = i0; idx < i1; idx++)
+        {
+            normalizedMap[idx] = static_cast<disp_t>(dispMap[idx] * static_cast<double>(numeric_limits<disp_t>::max()) / znccParams.maxDisp);
+        } });
 
     return normalizedMap;
 }
\ No newline at end of file
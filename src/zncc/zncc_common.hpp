@@ -9,10 +9,26 @@
 #include <atomic>
 #include <mutex>
 #include <map>
+#include <tuple>
+#include <cstdint>
+#include <limits>
 #include <omp.h>
+#include "../utils/thread_pool.hpp"
 
 using namespace std;
 
+// Element type of the disparity maps. uint8 keeps them compact, building with USE_DISP16 makes them uint16 for
+// disparity ranges above 256, e.g. full-resolution Middlebury 2021 frames.
+#ifdef USE_DISP16
+using disp_t = uint16_t;
+#else
+using disp_t = unsigned char;
+#endif
+using DispMap = vector<disp_t>;
+
+// Largest maxDisp the maps can hold, larger ones are refused instead of wrapping
+constexpr int MAX_DISP_RANGE = numeric_limits<disp_t>::max() + 1;
+
 // ZNCC methods enum and its helpers
 enum class ZnccMethod
 {
@@ -24,8 +40,41 @@ enum class ZnccMethod
     OPENCL_OPT1,
     OPENCL_OPT,
     OPENCL_OPT3,
+    OPENCL_TILED,
     // OPENCL_PIPE,
-    CUDA
+    CUDA,
+    INTEGRAL,
+    SLIDING_WINDOW,
+    COST_VOLUME,
+    SIMD_INTRINSICS,
+    TEMPLATED
+};
+
+// Accumulation used by the SIMD kernels, INTEGER sums the window terms exactly in int32/int64
+// and only normalizes once in floating point
+enum class ZnccPrecision
+{
+    DOUBLE,
+    INTEGER
+};
+
+// Curve fitted through the scores at d - 1, d and d + 1 of the best disparity d for a sub-pixel offset.
+// EQUIANGULAR fits two lines of opposite slopes, it is less biased towards whole disparities on steep peaks.
+enum class SubPixelFit
+{
+    NONE,
+    PARABOLA,
+    EQUIANGULAR
+};
+
+// Instruction set levels of the hand-written kernels, AUTO picks the best one the CPU supports
+enum class SimdIsa
+{
+    AUTO,
+    SCALAR,
+    SSE42,
+    AVX2,
+    AVX512BW
 };
 
 struct ZnccParams
@@ -43,6 +92,21 @@ struct ZnccParams
     bool withNormalization;
     ZnccMethod method;
     int platformId;
+    int bandRows = 16; // rows per band for COST_VOLUME, sized so a band's working set fits in L2
+    bool fusedLeftRight = false; // CPU methods fill both disparity maps from a single evaluation of the scores
+    ZnccPrecision precision = ZnccPrecision::DOUBLE;
+    SimdIsa simdIsa = SimdIsa::AUTO; // kernel level for SIMD_INTRINSICS, lowered to what the CPU supports
+    int pyramidLevels = 1; // > 1 searches the full range on the coarsest level only, and refines it on the finer ones
+    int refineRadius = 2; // disparities searched on each side of the prediction from the coarser level
+    int tileWidth = 64; // tile size of the work-stealing scheduler of MULTI_THREADED
+    int tileHeight = 16;
+    bool cacheTiling = false; // per-pixel CPU methods run on cache-sized tiles copied with their halo, in two passes even with fusedLeftRight
+    int cacheTileSize = 0; // 0 picks it from the L2 cache size
+    int framesInFlight = 2; // frames on the device at once in the OpenCL streaming mode
+    bool postProcOnDevice = false; // OPENCL_TILED keeps its maps on the device and post-processes them there
+    bool readIntermediateMaps = false; // with postProcOnDevice, also read back the left, right, cross-checked and occlusion-filled maps
+    SubPixelFit subPixel = SubPixelFit::NONE; // also fill float disparity maps with a fitted sub-pixel offset, keeps the maps on the host
+    bool boundedSearch = false; // two-pass INTEGRAL only, other methods and fusedLeftRight reject it: a disparity is dropped once a bound on its remaining window rows cannot beat the best, same maps
 };
 
 const map<ZnccMethod, string> ZnccString = {
@@ -54,11 +118,76 @@ const map<ZnccMethod, string> ZnccString = {
     {ZnccMethod::OPENCL_OPT1, "OPENCL_OPT1"},
     {ZnccMethod::OPENCL_OPT, "OPENCL_OPT"},
     {ZnccMethod::OPENCL_OPT3, "OPENCL_OPT3"},
+    {ZnccMethod::OPENCL_TILED, "OPENCL_TILED"},
     // {ZnccMethod::OPENCL_PIPE, "OPENCL_PIPE"},
     {ZnccMethod::CUDA, "CUDA"},
+    {ZnccMethod::INTEGRAL, "INTEGRAL"},
+    {ZnccMethod::SLIDING_WINDOW, "SLIDING_WINDOW"},
+    {ZnccMethod::COST_VOLUME, "COST_VOLUME"},
+    {ZnccMethod::SIMD_INTRINSICS, "SIMD_INTRINSICS"},
+    {ZnccMethod::TEMPLATED, "TEMPLATED"},
+};
+
+const map<SimdIsa, string> SimdIsaString = {
+    {SimdIsa::AUTO, "AUTO"},
+    {SimdIsa::SCALAR, "SCALAR"},
+    {SimdIsa::SSE42, "SSE42"},
+    {SimdIsa::AVX2, "AVX2"},
+    {SimdIsa::AVX512BW, "AVX512BW"},
+};
+
+// Summed-area tables of an image and of its squared values, (width + 1) x (height + 1)
+struct IntegralImage
+{
+    int width;
+    int height;
+    vector<long long> sum;
+    vector<long long> sqSum;
+};
+
+// Scores next to the best disparity of each pixel of a row or band, for the sub-pixel fit of the disparity-major
+// methods. update() takes every score of a pixel in increasing disparity order, right after its argmax update.
+struct SubPixelScores
+{
+    vector<double> prev;
+    vector<double> below;
+    vector<double> above;
+
+    void reset(int n)
+    {
+        prev.assign(n, NAN);
+        below.assign(n, NAN);
+        above.assign(n, NAN);
+    }
+
+    inline void update(int i, int d, double znccVal, bool newBest, int bestDisp)
+    {
+        if (newBest)
+        {
+            below[i] = prev[i];
+            above[i] = NAN;
+        }
+        else if (d == bestDisp + 1)
+        {
+            above[i] = znccVal;
+        }
+        prev[i] = znccVal;
+    }
+};
+
+// Exact window sums over the overlap of the two ZNCC windows
+struct ZnccSums
+{
+    long long count;
+    long long sum1;
+    long long sum2;
+    long long sqSum1;
+    long long sqSum2;
+    long long crossSum;
 };
 
 string ZnccMethodToString(ZnccMethod method);
+string SimdIsaToString(SimdIsa isa);
 
 double calculateMean(int x, int y, const vector<unsigned char> &img, const ZnccParams &znccParams);
 double calculateZncc(int x, int y, int d, double mean1, double mean2, const vector<unsigned char> &img1, const vector<unsigned char> &img2, const ZnccParams &znccParams);
@@ -66,6 +195,27 @@ double calculateZncc(int x, int y, int d, double mean1, double mean2, const vect
 double calculateMeanSimd(int x, int y, int width, int height, int halfWinSize, const vector<unsigned char> &img);
 double calculateZnccSimd(int x, int y, int d, double mean1, double mean2, int width, int height, int halfWinSize, const vector<unsigned char> &img1, const vector<unsigned char> &img2);
 
-vector<unsigned char> crosscheck(const vector<unsigned char> &dispMapLeft, const vector<unsigned char> &dispMapRight, const ZnccParams &znccParams);
-vector<unsigned char> fillOcclusion(const vector<unsigned char> &dispMap, const ZnccParams &znccParams);
-vector<unsigned char> normalizeMap(const vector<unsigned char> &dispMap, const ZnccParams &znccParams);
+tuple<long long, long long> calculateSumSimdInt(int x, int y, int width, int height, int halfWinSize, const vector<unsigned char> &img);
+ZnccSums calculateZnccSumsSimdInt(int x, int y, int d, int width, int height, int halfWinSize, const vector<unsigned char> &img1, const vector<unsigned char> &img2);
+
+IntegralImage buildIntegralImage(const vector<unsigned char> &img, int width, int height);
+long long integralSum(const vector<long long> &table, int width, int x0, int y0, int x1, int y1);
+double calculateZnccFromSums(const ZnccSums &sums, long long meanSum1, long long meanCount1, long long meanSum2, long long meanCount2);
+double calculateZnccIntegral(int x, int y, int d, const vector<unsigned char> &img1, const vector<unsigned char> &img2, const IntegralImage &integral1, const IntegralImage &integral2, const ZnccParams &znccParams);
+
+// bestDisp plus the offset of the fit through the scores around it, in [-0.5, 0.5]. A missing neighbour (NAN) at
+// the ends of the disparity range, or scores without a peak, keep the integer disparity.
+float subPixelDisparity(int bestDisp, double below, double best, double above, SubPixelFit fit);
+
+// Float disparities to uint16 in 1/16 pixel steps, scale converts them first, e.g. resizeFactor for full-resolution pixels
+vector<uint16_t> subPixelToFixed(const vector<float> &dispMap, float scale = 1.0f);
+
+DispMap crosscheck(const DispMap &dispMapLeft, const DispMap &dispMapRight, const ZnccParams &znccParams);
+DispMap fillOcclusion(const DispMap &dispMap, const ZnccParams &znccParams);
+// False, with a message, when the disparities of znccParams do not fit in disp_t
+bool dispRangeFits(const ZnccParams &znccParams);
+// False, with a message, when boundedSearch is set for a path without the bound
+bool boundedSearchFits(const ZnccParams &znccParams);
+
+// Scaled from [0, maxDisp] to the full range of disp_t
+DispMap normalizeMap(const DispMap &dispMap, const ZnccParams &znccParams);
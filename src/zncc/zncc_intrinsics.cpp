@@ -0,0 +1,413 @@
+#include "zncc_intrinsics.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ZNCC_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang need the target ISA on each kernel since the binary is built for the baseline,
+// MSVC accepts the intrinsics anywhere
+#if defined(_MSC_VER)
+#define ZNCC_TARGET(isa)
+#else
+#define ZNCC_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+SimdIsa detectSimdIsa()
+{
+    static const SimdIsa isa = []()
+    {
+#if defined(ZNCC_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+
+        __cpuid(info, 1);
+        bool sse42 = info[2] & (1 << 20);
+        bool osxsave = info[2] & (1 << 27);
+
+        // the OS must save the YMM and ZMM registers as well
+        unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        bool ymm = (xcr0 & 0x6) == 0x6;
+        bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+        bool avx2 = false, avx512bw = false;
+        if (maxLeaf >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = ymm && (info[1] & (1 << 5));
+            avx512bw = zmm && (info[1] & (1 << 16)) && (info[1] & (1 << 30)) && (info[1] & (1u << 31));
+        }
+
+        return avx512bw ? SimdIsa::AVX512BW : avx2 ? SimdIsa::AVX2 : sse42 ? SimdIsa::SSE42 : SimdIsa::SCALAR;
+#elif defined(ZNCC_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+            return SimdIsa::AVX512BW;
+        if (__builtin_cpu_supports("avx2"))
+            return SimdIsa::AVX2;
+        if (__builtin_cpu_supports("sse4.2"))
+            return SimdIsa::SSE42;
+        return SimdIsa::SCALAR;
+#else
+        return SimdIsa::SCALAR;
+#endif
+    }();
+
+    return isa;
+}
+
+SimdIsa resolveSimdIsa(SimdIsa requested)
+{
+    SimdIsa best = detectSimdIsa();
+    if (requested == SimdIsa::AUTO || static_cast<int>(requested) > static_cast<int>(best))
+        return best;
+    return requested;
+}
+
+// Window kernels: the whole window is accumulated in int32 lanes and reduced once at the end,
+// which is exact for windows up to 181x181. Pixels are widened to int16 and multiplied with madd,
+// which adds neighbouring products into int32 lanes. Rows run full-width steps, and the last
+// w % lanes pixels of a row take a single masked step instead of a loop of narrower ones.
+
+// Scalar fallback
+int windowSumScalar(const unsigned char *a, int stride, int w, int h)
+{
+    int sum = 0;
+    for (int yy = 0; yy < h; yy++, a += stride)
+    {
+        for (int i = 0; i < w; i++)
+        {
+            sum += a[i];
+        }
+    }
+    return sum;
+}
+
+void windowZnccSumsScalar(const unsigned char *a, const unsigned char *b, int stride, int w, int h, int sums[5])
+{
+    int sum1 = 0, sum2 = 0, sqSum1 = 0, sqSum2 = 0, crossSum = 0;
+    for (int yy = 0; yy < h; yy++, a += stride, b += stride)
+    {
+        for (int i = 0; i < w; i++)
+        {
+            int val1 = a[i];
+            int val2 = b[i];
+            sum1 += val1;
+            sum2 += val2;
+            sqSum1 += val1 * val1;
+            sqSum2 += val2 * val2;
+            crossSum += val1 * val2;
+        }
+    }
+    sums[0] = sum1;
+    sums[1] = sum2;
+    sums[2] = sqSum1;
+    sums[3] = sqSum2;
+    sums[4] = crossSum;
+}
+
+#ifdef ZNCC_X86
+
+// 32 zero lanes then 32 set ones, loading at 32 - n gives a mask whose first n int16 lanes are cleared. The SSE4.2
+// and AVX2 tails load the last 8 or 16 pixels of the row, which overlap the ones already summed, and clear those.
+alignas(64) const int16_t overlapMask[64] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                             -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+
+// SSE4.2, 8 pixels per step
+ZNCC_TARGET("sse4.2")
+int reduceSse42(__m128i v)
+{
+    v = _mm_hadd_epi32(v, v);
+    v = _mm_hadd_epi32(v, v);
+    return _mm_cvtsi128_si32(v);
+}
+
+// The five window sums at once, the first four share their horizontal adds
+ZNCC_TARGET("sse4.2")
+void reduceSums5Sse42(const __m128i acc[5], int sums[5])
+{
+    __m128i sums01 = _mm_hadd_epi32(acc[0], acc[1]);
+    __m128i sums23 = _mm_hadd_epi32(acc[2], acc[3]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), _mm_hadd_epi32(sums01, sums23));
+    sums[4] = reduceSse42(acc[4]);
+}
+
+ZNCC_TARGET("sse4.2")
+__m128i loadSse42(const unsigned char *p)
+{
+    return _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)));
+}
+
+ZNCC_TARGET("sse4.2")
+int windowSumSse42(const unsigned char *a, int stride, int w, int h)
+{
+    if (w < 8)
+        return windowSumScalar(a, stride, w, h);
+
+    const __m128i ones = _mm_set1_epi16(1);
+    const int vecEnd = w & ~7;
+    const __m128i tailMask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(overlapMask + 32 - (8 - (w - vecEnd))));
+    __m128i acc = _mm_setzero_si128();
+
+    for (int yy = 0; yy < h; yy++, a += stride)
+    {
+        for (int i = 0; i < vecEnd; i += 8)
+        {
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(loadSse42(a + i), ones));
+        }
+        if (vecEnd < w)
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_and_si128(loadSse42(a + w - 8), tailMask), ones));
+    }
+
+    return reduceSse42(acc);
+}
+
+// Adds the five products of one step of both windows
+ZNCC_TARGET("sse4.2")
+inline void accumulateSse42(__m128i acc[5], __m128i va, __m128i vb, __m128i ones)
+{
+    acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(va, ones));
+    acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(vb, ones));
+    acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(va, va));
+    acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(vb, vb));
+    acc[4] = _mm_add_epi32(acc[4], _mm_madd_epi16(va, vb));
+}
+
+ZNCC_TARGET("sse4.2")
+void windowZnccSumsSse42(const unsigned char *a, const unsigned char *b, int stride, int w, int h, int sums[5])
+{
+    if (w < 8)
+        return windowZnccSumsScalar(a, b, stride, w, h, sums);
+
+    const __m128i ones = _mm_set1_epi16(1);
+    const int vecEnd = w & ~7;
+    const __m128i tailMask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(overlapMask + 32 - (8 - (w - vecEnd))));
+    __m128i acc[5] = {_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+
+    for (int yy = 0; yy < h; yy++, a += stride, b += stride)
+    {
+        for (int i = 0; i < vecEnd; i += 8)
+        {
+            accumulateSse42(acc, loadSse42(a + i), loadSse42(b + i), ones);
+        }
+        if (vecEnd < w)
+            accumulateSse42(acc, _mm_and_si128(loadSse42(a + w - 8), tailMask), _mm_and_si128(loadSse42(b + w - 8), tailMask), ones);
+    }
+
+    reduceSums5Sse42(acc, sums);
+}
+
+// AVX2, 16 pixels per step. Windows narrower than a step go to the SSE4.2 kernels.
+ZNCC_TARGET("avx2")
+__m128i foldAvx2(__m256i v)
+{
+    return _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+ZNCC_TARGET("avx2")
+__m256i loadAvx2(const unsigned char *p)
+{
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+}
+
+ZNCC_TARGET("avx2")
+int windowSumAvx2(const unsigned char *a, int stride, int w, int h)
+{
+    if (w < 16)
+        return windowSumSse42(a, stride, w, h);
+
+    const __m256i ones = _mm256_set1_epi16(1);
+    const int vecEnd = w & ~15;
+    const __m256i tailMask = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(overlapMask + 32 - (16 - (w - vecEnd))));
+    __m256i acc = _mm256_setzero_si256();
+
+    for (int yy = 0; yy < h; yy++, a += stride)
+    {
+        for (int i = 0; i < vecEnd; i += 16)
+        {
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(loadAvx2(a + i), ones));
+        }
+        if (vecEnd < w)
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_and_si256(loadAvx2(a + w - 16), tailMask), ones));
+    }
+
+    return reduceSse42(foldAvx2(acc));
+}
+
+// Adds the five products of one step of both windows
+ZNCC_TARGET("avx2")
+inline void accumulateAvx2(__m256i acc[5], __m256i va, __m256i vb, __m256i ones)
+{
+    acc[0] = _mm256_add_epi32(acc[0], _mm256_madd_epi16(va, ones));
+    acc[1] = _mm256_add_epi32(acc[1], _mm256_madd_epi16(vb, ones));
+    acc[2] = _mm256_add_epi32(acc[2], _mm256_madd_epi16(va, va));
+    acc[3] = _mm256_add_epi32(acc[3], _mm256_madd_epi16(vb, vb));
+    acc[4] = _mm256_add_epi32(acc[4], _mm256_madd_epi16(va, vb));
+}
+
+ZNCC_TARGET("avx2")
+void windowZnccSumsAvx2(const unsigned char *a, const unsigned char *b, int stride, int w, int h, int sums[5])
+{
+    if (w < 16)
+        return windowZnccSumsSse42(a, b, stride, w, h, sums);
+
+    const __m256i ones = _mm256_set1_epi16(1);
+    const int vecEnd = w & ~15;
+    const __m256i tailMask = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(overlapMask + 32 - (16 - (w - vecEnd))));
+    __m256i acc[5] = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+
+    for (int yy = 0; yy < h; yy++, a += stride, b += stride)
+    {
+        for (int i = 0; i < vecEnd; i += 16)
+        {
+            accumulateAvx2(acc, loadAvx2(a + i), loadAvx2(b + i), ones);
+        }
+        if (vecEnd < w)
+            accumulateAvx2(acc, _mm256_and_si256(loadAvx2(a + w - 16), tailMask), _mm256_and_si256(loadAvx2(b + w - 16), tailMask), ones);
+    }
+
+    __m128i folded[5];
+    for (int k = 0; k < 5; k++)
+    {
+        folded[k] = foldAvx2(acc[k]);
+    }
+    reduceSums5Sse42(folded, sums);
+}
+
+// AVX-512BW, 32 pixels per step, the tail is a masked load that never touches the pixels past the window
+ZNCC_TARGET("avx512f,avx512bw,avx512vl")
+__m128i foldAvx512(__m512i v)
+{
+    // the zero-masked extracts, gcc 12 warns on the undefined vector behind the plain cast and extract
+    __m256i r = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF, v, 0), _mm512_maskz_extracti64x4_epi64(0xFF, v, 1));
+    return _mm_add_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+}
+
+ZNCC_TARGET("avx512f,avx512bw,avx512vl")
+__m512i loadAvx512(const unsigned char *p, __mmask32 mask)
+{
+    return _mm512_cvtepu8_epi16(_mm256_maskz_loadu_epi8(mask, p));
+}
+
+ZNCC_TARGET("avx512f,avx512bw,avx512vl")
+int windowSumAvx512(const unsigned char *a, int stride, int w, int h)
+{
+    const __m512i ones = _mm512_set1_epi16(1);
+    const int vecEnd = w & ~31;
+    const __mmask32 tailMask = static_cast<__mmask32>((1ULL << (w - vecEnd)) - 1);
+    __m512i acc = _mm512_setzero_si512();
+
+    for (int yy = 0; yy < h; yy++, a += stride)
+    {
+        for (int i = 0; i < vecEnd; i += 32)
+        {
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(loadAvx512(a + i, 0xffffffffu), ones));
+        }
+        if (vecEnd < w)
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(loadAvx512(a + vecEnd, tailMask), ones));
+    }
+
+    return reduceSse42(foldAvx512(acc));
+}
+
+// Adds the five products of one step of both windows
+ZNCC_TARGET("avx512f,avx512bw,avx512vl")
+inline void accumulateAvx512(__m512i acc[5], __m512i va, __m512i vb, __m512i ones)
+{
+    acc[0] = _mm512_add_epi32(acc[0], _mm512_madd_epi16(va, ones));
+    acc[1] = _mm512_add_epi32(acc[1], _mm512_madd_epi16(vb, ones));
+    acc[2] = _mm512_add_epi32(acc[2], _mm512_madd_epi16(va, va));
+    acc[3] = _mm512_add_epi32(acc[3], _mm512_madd_epi16(vb, vb));
+    acc[4] = _mm512_add_epi32(acc[4], _mm512_madd_epi16(va, vb));
+}
+
+ZNCC_TARGET("avx512f,avx512bw,avx512vl")
+void windowZnccSumsAvx512(const unsigned char *a, const unsigned char *b, int stride, int w, int h, int sums[5])
+{
+    const __m512i ones = _mm512_set1_epi16(1);
+    const int vecEnd = w & ~31;
+    const __mmask32 tailMask = static_cast<__mmask32>((1ULL << (w - vecEnd)) - 1);
+    __m512i acc[5] = {_mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512()};
+
+    for (int yy = 0; yy < h; yy++, a += stride, b += stride)
+    {
+        for (int i = 0; i < vecEnd; i += 32)
+        {
+            accumulateAvx512(acc, loadAvx512(a + i, 0xffffffffu), loadAvx512(b + i, 0xffffffffu), ones);
+        }
+        if (vecEnd < w)
+            accumulateAvx512(acc, loadAvx512(a + vecEnd, tailMask), loadAvx512(b + vecEnd, tailMask), ones);
+    }
+
+    __m128i folded[5];
+    for (int k = 0; k < 5; k++)
+    {
+        folded[k] = foldAvx512(acc[k]);
+    }
+    reduceSums5Sse42(folded, sums);
+}
+
+#endif // ZNCC_X86
+
+SimdKernels getSimdKernels(SimdIsa requested)
+{
+    SimdIsa isa = resolveSimdIsa(requested);
+
+    switch (isa)
+    {
+#ifdef ZNCC_X86
+    case SimdIsa::AVX512BW:
+        return SimdKernels{isa, windowSumAvx512, windowZnccSumsAvx512};
+    case SimdIsa::AVX2:
+        return SimdKernels{isa, windowSumAvx2, windowZnccSumsAvx2};
+    case SimdIsa::SSE42:
+        return SimdKernels{isa, windowSumSse42, windowZnccSumsSse42};
+#endif
+    default:
+        return SimdKernels{SimdIsa::SCALAR, windowSumScalar, windowZnccSumsScalar};
+    }
+}
+
+// Same window ranges as calculateSumSimdInt
+tuple<long long, long long> calculateSumIntrinsics(int x, int y, int width, int height, int halfWinSize, const vector<unsigned char> &img, const SimdKernels &kernels)
+{
+    int yy_0 = max(0, y - halfWinSize);
+    int yy_1 = min(height, y + halfWinSize + 1);
+    int xx_0 = max(0, x - halfWinSize);
+    int xx_1 = min(width, x + halfWinSize + 1);
+
+    if (xx_1 <= xx_0 || yy_1 <= yy_0)
+        return make_tuple(0LL, 0LL);
+
+    long long sum = kernels.windowSum(&img[yy_0 * width + xx_0], width, xx_1 - xx_0, yy_1 - yy_0);
+
+    return make_tuple(sum, static_cast<long long>(xx_1 - xx_0) * (yy_1 - yy_0));
+}
+
+// Same window ranges as calculateZnccSumsSimdInt
+ZnccSums calculateZnccSumsIntrinsics(int x, int y, int d, int width, int height, int halfWinSize, const vector<unsigned char> &img1, const vector<unsigned char> &img2, const SimdKernels &kernels)
+{
+    int yy_0 = max(0, y - halfWinSize);
+    int yy_1 = min(height, y + halfWinSize + 1);
+    int xx_0 = max(d, x - halfWinSize);
+    int xx_1 = min(width - d, x + halfWinSize + 1);
+
+    ZnccSums sums{0, 0, 0, 0, 0, 0};
+    if (xx_1 <= xx_0 || yy_1 <= yy_0)
+        return sums;
+
+    int windowSums[5];
+    kernels.windowZnccSums(&img1[yy_0 * width + xx_0], &img2[yy_0 * width + xx_0 - d], width, xx_1 - xx_0, yy_1 - yy_0, windowSums);
+    sums.sum1 = windowSums[0];
+    sums.sum2 = windowSums[1];
+    sums.sqSum1 = windowSums[2];
+    sums.sqSum2 = windowSums[3];
+    sums.crossSum = windowSums[4];
+    sums.count = static_cast<long long>(xx_1 - xx_0) * (yy_1 - yy_0);
+
+    return sums;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include "zncc_common.hpp"
+
+using namespace std;
+
+// Best instruction set supported by the CPU, queried once with CPUID
+SimdIsa detectSimdIsa();
+
+// The requested level, lowered to what the CPU supports
+SimdIsa resolveSimdIsa(SimdIsa requested);
+
+// Window kernels over w x h pixels of rows stride apart: the sum of one image, and the five ZNCC
+// sums (a, b, a^2, b^2, a*b) of two images, exact in int32 for windows up to 181x181
+constexpr int MAX_INTRINSICS_WIN_SIZE = 181; // 181^2 * 255^2 < 2^31
+
+// False when a window of winSize would overflow the int32 sums of the kernels
+inline bool intrinsicsWindowFits(int winSize) { return winSize <= MAX_INTRINSICS_WIN_SIZE; }
+
+using WindowSumFn = int (*)(const unsigned char *a, int stride, int w, int h);
+using WindowZnccSumsFn = void (*)(const unsigned char *a, const unsigned char *b, int stride, int w, int h, int sums[5]);
+
+struct SimdKernels
+{
+    SimdIsa isa;
+    WindowSumFn windowSum;
+    WindowZnccSumsFn windowZnccSums;
+};
+
+SimdKernels getSimdKernels(SimdIsa requested = SimdIsa::AUTO);
+
+tuple<long long, long long> calculateSumIntrinsics(int x, int y, int width, int height, int halfWinSize, const vector<unsigned char> &img, const SimdKernels &kernels);
+ZnccSums calculateZnccSumsIntrinsics(int x, int y, int d, int width, int height, int halfWinSize, const vector<unsigned char> &img1, const vector<unsigned char> &img2, const SimdKernels &kernels);
@@ -2,8 +2,29 @@
 
 #ifdef USE_OCL
 
-tuple<cl::Context, cl::CommandQueue, cl::Program> configure_opencl(const char* kernel_name, int platform_id)
+// Context and queue of the first device of a platform, created once per process
+struct OpenclDevice
 {
+    cl::Device device;
+    cl::Context context;
+    cl::CommandQueue queue;
+    bool hostUnified; // CPUs and integrated GPUs, buffers can live in host memory without any transfer
+};
+
+mutex opencl_cache_mutex;
+map<int, OpenclDevice> openclDevices;
+map<tuple<int, string, string>, cl::Program> openclPrograms;
+map<tuple<int, string, size_t>, cl::Buffer> openclBuffers;
+OpenclCacheStats openclCacheStats;
+
+// Called with opencl_cache_mutex held. The context hits and misses are counted by configure_opencl only, once per
+// OpenCL call, not by the buffer helpers looking the device up again.
+OpenclDevice &get_opencl_device(int platform_id)
+{
+    auto it = openclDevices.find(platform_id);
+    if (it != openclDevices.end())
+        return it->second;
+
     // Query for platforms
     vector<cl::Platform> platforms;
     cl::Platform::get(&platforms);
@@ -11,52 +32,221 @@ tuple<cl::Context, cl::CommandQueue, cl::Program> configure_opencl(const char* k
     // Get a list of devices on this platform
     vector<cl::Device> devices;
     platforms[platform_id].getDevices(CL_DEVICE_TYPE_ALL, &devices);
-    auto deviceName = devices[0].getInfo<CL_DEVICE_NAME>();
-    cout << "# Running " << kernel_name << " on " << deviceName << endl;
 
-    // Create a context for the devices
-    cl::Context context(devices);
+    // Create a context and a command−queue for the first device, with profiling for the device-side stage times
+    cl::Context context(vector<cl::Device>{devices[0]});
+    cl::CommandQueue queue(context, devices[0], CL_QUEUE_PROFILING_ENABLE);
+
+    bool hostUnified = (devices[0].getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) || devices[0].getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
 
-    // Create a command−queue for the first device
-    cl::CommandQueue queue = cl::CommandQueue(context, devices[0]);
+    return openclDevices.emplace(platform_id, OpenclDevice{devices[0], context, queue, hostUnified}).first->second;
+}
+
+void save_program_binary(const cl::Program &program, const string &path)
+{
+    size_t binarySize = 0;
+    clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarySize, NULL);
+    if (binarySize == 0)
+        return;
+
+    vector<unsigned char> binary(binarySize);
+    unsigned char *binaryPtr = binary.data();
+    clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(unsigned char *), &binaryPtr, NULL);
+
+    filesystem::create_directories(filesystem::path(path).parent_path());
+    ofstream binaryFile(path, ios::binary);
+    binaryFile.write(reinterpret_cast<const char *>(binary.data()), binarySize);
+}
 
+// Program from the binary saved by an earlier run if there is a valid one, else built from source and saved.
+// Binaries are keyed by device, driver, build options and source, so any of them changing rebuilds.
+cl::Program load_or_build_program(OpenclDevice &device, const char *kernel_name, const string &build_options)
+{
     // Read the program source
     ifstream sourceFile("kernels/" + string(kernel_name));
     string sourceCode(istreambuf_iterator<char>(sourceFile), (istreambuf_iterator<char>()));
-    cl::Program::Sources source(1, make_pair(sourceCode.c_str(), sourceCode.length() + 1));
+
+    auto deviceName = device.device.getInfo<CL_DEVICE_NAME>();
+    auto driverVersion = device.device.getInfo<CL_DRIVER_VERSION>();
+    ostringstream binaryPath;
+    binaryPath << "kernels/cache/" << kernel_name << "." << hex << hash<string>{}(deviceName + "|" + driverVersion + "|" + build_options + "|" + sourceCode) << ".bin";
+
+    vector<cl::Device> devices{device.device};
+    auto start = chrono::high_resolution_clock::now();
+    auto elapsedUs = [&]()
+    { return chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count(); };
+
+    ifstream binaryFile(binaryPath.str(), ios::binary);
+    if (binaryFile)
+    {
+        string binary(istreambuf_iterator<char>(binaryFile), (istreambuf_iterator<char>()));
+        try
+        {
+            cl::Program::Binaries binaries(1, make_pair(binary.data(), binary.size()));
+            cl::Program program(device.context, devices, binaries);
+            program.build(devices, build_options.c_str());
+
+            auto buildUs = elapsedUs();
+            openclCacheStats.binaryLoads++;
+            openclCacheStats.buildUs += buildUs;
+            cout << "# Loaded " << kernel_name << " from " << binaryPath.str() << " in " << buildUs << " us" << endl;
+            return program;
+        }
+        catch (const cl::Error &error)
+        {
+            cout << "# Cached binary rejected, " << error.what() << ": " << get_cl_err(error.err()) << endl;
+        }
+    }
 
     // Create the program from the source code
-    cl::Program program = cl::Program(context, source);
+    cl::Program::Sources source(1, make_pair(sourceCode.c_str(), sourceCode.length() + 1));
+    cl::Program program = cl::Program(device.context, source);
 
     // Build the program for the devices
-    auto err = program.build(devices);
+    auto err = program.build(devices, build_options.c_str());
     cout << get_cl_err(err) << endl;
 
-    return make_tuple(context, queue, program);
+    auto buildUs = elapsedUs();
+    openclCacheStats.sourceBuilds++;
+    openclCacheStats.buildUs += buildUs;
+    cout << "# Built " << kernel_name << " from source in " << buildUs << " us" << endl;
+
+    save_program_binary(program, binaryPath.str());
+    return program;
+}
+
+// Contexts, queues and programs are cached per (platform, kernel file, build options) for the whole process.
+// The kernels write their maps as DISP_T, the element type of DispMap.
+tuple<cl::Context, cl::CommandQueue, cl::Program> configure_opencl(const char* kernel_name, int platform_id, const string &extra_options = "")
+{
+    lock_guard<mutex> lock(opencl_cache_mutex);
+    const string build_options = (sizeof(disp_t) == 2 ? "-DDISP_T=ushort -DDISP_MAX=65535 " : "-DDISP_T=uchar -DDISP_MAX=255 ") + extra_options;
+
+    if (openclDevices.count(platform_id))
+        openclCacheStats.contextHits++;
+    else
+        openclCacheStats.contextMisses++;
+    auto &device = get_opencl_device(platform_id);
+    auto deviceName = device.device.getInfo<CL_DEVICE_NAME>();
+    cout << "# Running " << kernel_name << " on " << deviceName << endl;
+
+    auto key = make_tuple(platform_id, string(kernel_name), build_options);
+    auto it = openclPrograms.find(key);
+    if (it != openclPrograms.end())
+    {
+        openclCacheStats.programHits++;
+        return make_tuple(device.context, device.queue, it->second);
+    }
+    openclCacheStats.programMisses++;
+
+    auto program = load_or_build_program(device, kernel_name, build_options);
+    openclPrograms.emplace(key, program);
+
+    return make_tuple(device.context, device.queue, program);
+}
+
+OpenclCacheStats getOpenclCacheStats()
+{
+    lock_guard<mutex> lock(opencl_cache_mutex);
+    return openclCacheStats;
+}
+
+void printOpenclCacheStats()
+{
+    auto stats = getOpenclCacheStats();
+    cout << "# OpenCL cache: contexts " << stats.contextHits << " hits / " << stats.contextMisses << " misses, programs " << stats.programHits << " hits / " << stats.programMisses << " misses ("
+         << stats.binaryLoads << " from binary, " << stats.sourceBuilds << " from source), " << stats.buildUs << " us building, buffers "
+         << stats.bufferHits << " hits / " << stats.bufferMisses << " misses, " << stats.hostBuffers << " in host memory" << endl;
+}
+
+OpenclDevice &opencl_device(int platform_id)
+{
+    lock_guard<mutex> lock(opencl_cache_mutex);
+    return get_opencl_device(platform_id);
+}
+
+// Device buffer for one role of a ZNCC call, allocated once per (platform, role, size) and reused by later
+// calls. The OpenCL calls run one at a time and finish before returning, so a role is never in use twice.
+cl::Buffer pooled_buffer(int platform_id, const string &role, size_t size, cl_mem_flags flags)
+{
+    lock_guard<mutex> lock(opencl_cache_mutex);
+
+    auto key = make_tuple(platform_id, role, size);
+    auto it = openclBuffers.find(key);
+    if (it != openclBuffers.end())
+    {
+        openclCacheStats.bufferHits++;
+        return it->second;
+    }
+    openclCacheStats.bufferMisses++;
+    if (flags & CL_MEM_ALLOC_HOST_PTR)
+        openclCacheStats.hostBuffers++;
+
+    cl::Buffer buffer(get_opencl_device(platform_id).context, flags, size, NULL, NULL);
+    openclBuffers.emplace(key, buffer);
+    return buffer;
+}
+
+// Input image in a pooled buffer. On devices sharing host memory the runtime allocates it there, aligned as the
+// device wants it, and the image is copied in through a map, so the kernels read it without a transfer.
+cl::Buffer input_buffer(int platform_id, const string &role, const vector<unsigned char> &img)
+{
+    auto &device = opencl_device(platform_id);
+    if (!device.hostUnified)
+    {
+        cl::Buffer buffer = pooled_buffer(platform_id, role, img.size(), CL_MEM_READ_ONLY);
+        device.queue.enqueueWriteBuffer(buffer, CL_FALSE, 0, img.size(), img.data());
+        return buffer;
+    }
+
+    cl::Buffer buffer = pooled_buffer(platform_id, role, img.size(), CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    void *mapped = device.queue.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, img.size());
+    memcpy(mapped, img.data(), img.size());
+    device.queue.enqueueUnmapMemObject(buffer, mapped);
+    return buffer;
 }
 
-tuple<cl::Buffer, cl::Buffer, cl::Buffer> configure_buffers(cl::Context context, cl::CommandQueue queue, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, size_t inputSize)
+// Output map in a pooled buffer for read_output, in host memory on devices sharing it
+cl::Buffer output_buffer(int platform_id, const string &role, DispMap &out)
 {
-    // Create OpenCL memory buffers
-    cl::Buffer leftImgBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, inputSize, NULL, NULL);
-    cl::Buffer rightImgBuffer = cl::Buffer(context, CL_MEM_READ_ONLY, inputSize, NULL, NULL);
-    cl::Buffer dispMapBuffer = cl::Buffer(context, CL_MEM_WRITE_ONLY, inputSize, NULL, NULL);
+    auto &device = opencl_device(platform_id);
+    const cl_mem_flags flags = device.hostUnified ? CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR : CL_MEM_WRITE_ONLY;
+    return pooled_buffer(platform_id, role, out.size() * sizeof(disp_t), flags);
+}
 
-    // Copy the input data to the input buffers
-    queue.enqueueWriteBuffer(leftImgBuffer, CL_TRUE, 0, inputSize, &leftImg[0]);
-    queue.enqueueWriteBuffer(rightImgBuffer, CL_TRUE, 0, inputSize, &rightImg[0]);
+// Blocking read of an output buffer into out. Buffers in host memory are mapped and copied from, without a
+// transfer from the device.
+void read_output(int platform_id, const cl::Buffer &buffer, DispMap &out)
+{
+    auto &device = opencl_device(platform_id);
+    if (!device.hostUnified)
+    {
+        device.queue.enqueueReadBuffer(buffer, CL_TRUE, 0, out.size() * sizeof(disp_t), &out[0]);
+        return;
+    }
+
+    void *mapped = device.queue.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_READ, 0, out.size() * sizeof(disp_t));
+    memcpy(out.data(), mapped, out.size() * sizeof(disp_t));
+    device.queue.enqueueUnmapMemObject(buffer, mapped);
+    device.queue.finish();
+}
+
+tuple<cl::Buffer, cl::Buffer, cl::Buffer> configure_buffers(int platform_id, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, DispMap &dispMap)
+{
+    cl::Buffer leftImgBuffer = input_buffer(platform_id, "leftImg", leftImg);
+    cl::Buffer rightImgBuffer = input_buffer(platform_id, "rightImg", rightImg);
+    cl::Buffer dispMapBuffer = output_buffer(platform_id, "dispMap", dispMap);
 
     return make_tuple(leftImgBuffer, rightImgBuffer, dispMapBuffer);
 }
 
 
-void zncc_opencl(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool reverse)
+void zncc_opencl(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool reverse)
 {
     try
     {
-        size_t inputSize = sizeof(unsigned char) * leftImg.size();
         auto [context, queue, program] = configure_opencl("zncc_kernels_naive.cl", znccParams.platformId);
-        auto [leftImgBuffer, rightImgBuffer, dispMapBuffer] = configure_buffers(context, queue, leftImg, rightImg, inputSize);
+        auto [leftImgBuffer, rightImgBuffer, dispMapBuffer] = configure_buffers(znccParams.platformId, leftImg, rightImg, dispMap);
 
         // Create the kernel
         cl::Kernel zncc_kernel(program, "zncc_kernel");
@@ -78,29 +268,24 @@ void zncc_opencl(vector<unsigned char> &dispMap, const vector<unsigned char> &le
 
         // Copy the output data back to the host
         // unsigned char *tmpDisparity;
-        queue.enqueueReadBuffer(dispMapBuffer, CL_TRUE, 0, inputSize, &dispMap[0]);
+        read_output(znccParams.platformId, dispMapBuffer, dispMap);
     }
-    catch (cl::Error error)
+    catch (const cl::Error &error)
     {
         cout << error.what() << ": " << get_cl_err(error.err()) << endl;
     }
 }
 
-void zncc_opencl_opt1(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+void zncc_opencl_opt1(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
 {
     try
     {
-        size_t inputSize = sizeof(unsigned char) * leftImg.size();
         auto [context, queue, program] = configure_opencl("zncc_kernels_opt1.cl", znccParams.platformId);
-        auto [leftImgBuffer, rightImgBuffer, dispMapBuffer] = configure_buffers(context, queue, leftImg, rightImg, inputSize);
+        auto [leftImgBuffer, rightImgBuffer, dispMapBuffer] = configure_buffers(znccParams.platformId, leftImg, rightImg, dispMap);
 
         size_t intermediateSize = sizeof(float) * znccParams.maxDisp;
-        cl::Buffer meanValsBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, intermediateSize, NULL, NULL);
-        cl::Buffer znccValsBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, intermediateSize, NULL, NULL);
-
-        // Copy the input data to the input buffers
-        queue.enqueueWriteBuffer(leftImgBuffer, CL_TRUE, 0, inputSize, &leftImg[0]);
-        queue.enqueueWriteBuffer(rightImgBuffer, CL_TRUE, 0, inputSize, &rightImg[0]);
+        cl::Buffer meanValsBuffer = pooled_buffer(znccParams.platformId, "meanVals", intermediateSize, CL_MEM_READ_WRITE);
+        cl::Buffer znccValsBuffer = pooled_buffer(znccParams.platformId, "znccVals", intermediateSize, CL_MEM_READ_WRITE);
 
         // Create the kernel
         cl::Kernel zncc_kernel(program, "zncc_kernel");
@@ -124,22 +309,21 @@ void zncc_opencl_opt1(vector<unsigned char> &dispMap, const vector<unsigned char
 
         // Copy the output data back to the host
         // unsigned char *tmpDisparity;
-        queue.enqueueReadBuffer(dispMapBuffer, CL_TRUE, 0, inputSize, &dispMap[0]);
+        read_output(znccParams.platformId, dispMapBuffer, dispMap);
     }
-    catch (cl::Error error)
+    catch (const cl::Error &error)
     {
         cout << error.what() << ": " << get_cl_err(error.err()) << endl;
     }
 }
 
 
-void zncc_opencl_opt(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool reverse)
+void zncc_opencl_opt(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool reverse)
 {
     try
     {
-        size_t inputSize = sizeof(unsigned char) * leftImg.size();
         auto [context, queue, program] = configure_opencl("zncc_kernels_opt2.cl", znccParams.platformId);
-        auto [leftImgBuffer, rightImgBuffer, dispMapBuffer] = configure_buffers(context, queue, leftImg, rightImg, inputSize);
+        auto [leftImgBuffer, rightImgBuffer, dispMapBuffer] = configure_buffers(znccParams.platformId, leftImg, rightImg, dispMap);
 
         // Create the kernel
         cl::Kernel zncc_kernel(program, "zncc_kernel");
@@ -161,23 +345,21 @@ void zncc_opencl_opt(vector<unsigned char> &dispMap, const vector<unsigned char>
 
         // Copy the output data back to the host
         // unsigned char *tmpDisparity;
-        queue.enqueueReadBuffer(dispMapBuffer, CL_TRUE, 0, inputSize, &dispMap[0]);
+        read_output(znccParams.platformId, dispMapBuffer, dispMap);
     }
-    catch (cl::Error error)
+    catch (const cl::Error &error)
     {
         cout << error.what() << ": " << get_cl_err(error.err()) << endl;
     }
 }
 
-void zncc_opencl_opt3(vector<unsigned char> &leftDispMap, vector<unsigned char> &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+void zncc_opencl_opt3(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
 {
     try
     {
-        size_t inputSize = sizeof(unsigned char) * leftImg.size();
         auto [context, queue, program] = configure_opencl("zncc_kernels_opt3.cl", znccParams.platformId);
-        auto [leftImgBuffer, rightImgBuffer, leftDispMapBuffer] = configure_buffers(context, queue, leftImg, rightImg, inputSize);
-
-        cl::Buffer rightDispMapBuffer = cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, inputSize, NULL, NULL);
+        auto [leftImgBuffer, rightImgBuffer, leftDispMapBuffer] = configure_buffers(znccParams.platformId, leftImg, rightImg, leftDispMap);
+        cl::Buffer rightDispMapBuffer = output_buffer(znccParams.platformId, "rightDispMap", rightDispMap);
 
         // Create the kernel
         cl::Kernel zncc_kernel(program, "zncc_kernel");
@@ -200,17 +382,355 @@ void zncc_opencl_opt3(vector<unsigned char> &leftDispMap, vector<unsigned char>
 
         // Copy the output data back to the host
         // unsigned char *tmpDisparity;
-        queue.enqueueReadBuffer(leftDispMapBuffer, CL_TRUE, 0, inputSize, &leftDispMap[0]);
-        queue.enqueueReadBuffer(rightDispMapBuffer, CL_TRUE, 0, inputSize, &rightDispMap[0]);
+        read_output(znccParams.platformId, leftDispMapBuffer, leftDispMap);
+        read_output(znccParams.platformId, rightDispMapBuffer, rightDispMap);
     }
-    catch (cl::Error error)
+    catch (const cl::Error &error)
     {
         cout << error.what() << ": " << get_cl_err(error.err()) << endl;
     }
 }
 
+// Local memory of the left and right image tiles of zncc_tiled_kernel for a work-group of tileWidth x tileHeight
+tuple<size_t, size_t> tiled_local_mem_sizes(int tileWidth, int tileHeight, const ZnccParams &znccParams)
+{
+    size_t leftWidth = tileWidth + znccParams.winSize - 1;
+    size_t rightWidth = leftWidth + znccParams.maxDisp - 1;
+    size_t tileRows = tileHeight + znccParams.winSize - 1;
+    return make_tuple(leftWidth * tileRows, rightWidth * tileRows);
+}
+
+// Largest work-group whose tiles fit in the local memory the kernel has left on the device, {0, 0} if none does
+tuple<int, int> pick_local_tile(const cl::Device &device, const cl::Kernel &kernel, const ZnccParams &znccParams)
+{
+    size_t maxGroupSize = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    cl_ulong localMemSize = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() - kernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device);
+
+    for (auto [tileWidth, tileHeight] : {make_tuple(32, 16), make_tuple(16, 16), make_tuple(32, 8), make_tuple(16, 8), make_tuple(8, 8), make_tuple(8, 4), make_tuple(4, 4), make_tuple(1, 1)})
+    {
+        auto [leftTileSize, rightTileSize] = tiled_local_mem_sizes(tileWidth, tileHeight, znccParams);
+        if (static_cast<size_t>(tileWidth * tileHeight) <= maxGroupSize && leftTileSize + rightTileSize <= localMemSize)
+            return make_tuple(tileWidth, tileHeight);
+    }
+    return make_tuple(0, 0);
+}
+
+// Enqueue zncc_tiled_kernel for img1 against img2 on work-groups of tileWidth x tileHeight
+void enqueue_tiled_kernel(const cl::CommandQueue &queue, cl::Kernel &zncc_kernel, int tileWidth, int tileHeight, const cl::Buffer &img1Buffer, const cl::Buffer &img2Buffer, const cl::Buffer &dispMapBuffer, const ZnccParams &znccParams,
+                          const vector<cl::Event> *waitEvents = NULL, cl::Event *event = NULL)
+{
+    auto [leftTileSize, rightTileSize] = tiled_local_mem_sizes(tileWidth, tileHeight, znccParams);
+
+    // Set the kernel arguments
+    zncc_kernel.setArg(0, img1Buffer);
+    zncc_kernel.setArg(1, img2Buffer);
+    zncc_kernel.setArg(2, dispMapBuffer);
+    zncc_kernel.setArg(3, znccParams.width);
+    zncc_kernel.setArg(4, znccParams.height);
+    zncc_kernel.setArg(5, znccParams.winSize);
+    zncc_kernel.setArg(6, znccParams.maxDisp);
+    zncc_kernel.setArg(7, cl::Local(leftTileSize));
+    zncc_kernel.setArg(8, cl::Local(rightTileSize));
+
+    // Execute the kernel, the global range rounded up to whole work-groups
+    cl::NDRange global((znccParams.width + tileWidth - 1) / tileWidth * tileWidth, (znccParams.height + tileHeight - 1) / tileHeight * tileHeight);
+    cl::NDRange local(tileWidth, tileHeight);
+    queue.enqueueNDRangeKernel(zncc_kernel, cl::NullRange, global, local, waitEvents, event);
+}
+
+void zncc_opencl_tiled(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    try
+    {
+        auto [context, queue, program] = configure_opencl("zncc_kernels_tiled.cl", znccParams.platformId);
+        cl::Kernel zncc_kernel(program, "zncc_tiled_kernel");
+
+        auto [tileWidth, tileHeight] = pick_local_tile(opencl_device(znccParams.platformId).device, zncc_kernel, znccParams);
+        if (tileWidth == 0)
+        {
+            cout << "# OpenCL tiles of winSize " << znccParams.winSize << ", maxDisp " << znccParams.maxDisp << " do not fit in local memory, using the naive kernel" << endl;
+            zncc_opencl(dispMap, leftImg, rightImg, znccParams, false);
+            return;
+        }
+        auto [leftTileSize, rightTileSize] = tiled_local_mem_sizes(tileWidth, tileHeight, znccParams);
+        cout << "# OpenCL work-group " << tileWidth << "x" << tileHeight << ", " << leftTileSize + rightTileSize << " bytes of local memory" << endl;
+
+        auto [leftImgBuffer, rightImgBuffer, dispMapBuffer] = configure_buffers(znccParams.platformId, leftImg, rightImg, dispMap);
+
+        enqueue_tiled_kernel(queue, zncc_kernel, tileWidth, tileHeight, leftImgBuffer, rightImgBuffer, dispMapBuffer, znccParams);
+        queue.finish();
+
+        read_output(znccParams.platformId, dispMapBuffer, dispMap);
+    }
+    catch (const cl::Error &error)
+    {
+        cout << error.what() << ": " << get_cl_err(error.err()) << endl;
+    }
+}
+
+// Host images, maps and device buffers of one frame in flight in zncc_opencl_stream
+struct ZnccStreamSlot
+{
+    int frameIdx = -1;
+    vector<unsigned char> leftImg;
+    vector<unsigned char> rightImg;
+    DispMap leftDispMap;
+    DispMap rightDispMap;
+    cl::Buffer leftImgBuffer;
+    cl::Buffer rightImgBuffer;
+    cl::Buffer leftDispMapBuffer;
+    cl::Buffer rightDispMapBuffer;
+    vector<cl::Event> downloadEvents;
+};
+
+int zncc_opencl_stream(const ZnccFrameSource &source, const ZnccFrameSink &sink, const ZnccParams &znccParams)
+{
+    const size_t numPixels = static_cast<size_t>(znccParams.width) * znccParams.height;
+    const size_t mapBytes = numPixels * sizeof(disp_t);
+    const int numSlots = max(1, znccParams.framesInFlight);
+    int numFrames = 0;
+
+    try
+    {
+        auto [context, queue, program] = configure_opencl("zncc_kernels_tiled.cl", znccParams.platformId);
+        auto &device = opencl_device(znccParams.platformId);
+        cl::Kernel zncc_kernel(program, "zncc_tiled_kernel");
+
+        auto [tileWidth, tileHeight] = pick_local_tile(device.device, zncc_kernel, znccParams);
+        if (tileWidth == 0)
+        {
+            cout << "# OpenCL tiles of winSize " << znccParams.winSize << ", maxDisp " << znccParams.maxDisp << " do not fit in local memory, streaming frame by frame with the naive kernel" << endl;
+            vector<unsigned char> leftImg, rightImg;
+            while (source(leftImg, rightImg))
+            {
+                DispMap leftDispMap(numPixels), rightDispMap(numPixels);
+                zncc_opencl(leftDispMap, leftImg, rightImg, znccParams, false);
+                zncc_opencl(rightDispMap, rightImg, leftImg, znccParams, false);
+                sink(numFrames++, leftDispMap, rightDispMap);
+            }
+            return numFrames;
+        }
+
+        // The kernels run on the cached queue, uploads and downloads on their own in-order queues,
+        // so one frame's upload and another frame's download can run during a third frame's kernels
+        cl::CommandQueue uploadQueue(context, device.device);
+        cl::CommandQueue downloadQueue(context, device.device);
+
+        vector<ZnccStreamSlot> slots(numSlots);
+        for (int s = 0; s < numSlots; s++)
+        {
+            string role = "stream" + to_string(s) + ".";
+            slots[s].leftImgBuffer = pooled_buffer(znccParams.platformId, role + "leftImg", numPixels, CL_MEM_READ_ONLY);
+            slots[s].rightImgBuffer = pooled_buffer(znccParams.platformId, role + "rightImg", numPixels, CL_MEM_READ_ONLY);
+            slots[s].leftDispMapBuffer = pooled_buffer(znccParams.platformId, role + "leftDispMap", mapBytes, CL_MEM_WRITE_ONLY);
+            slots[s].rightDispMapBuffer = pooled_buffer(znccParams.platformId, role + "rightDispMap", mapBytes, CL_MEM_WRITE_ONLY);
+        }
+
+        // Hand a finished frame to the sink, its download being done also means the slot is free again
+        auto finishSlot = [&](ZnccStreamSlot &slot)
+        {
+            if (slot.frameIdx < 0)
+                return;
+            for (auto &event : slot.downloadEvents)
+                event.wait();
+            sink(slot.frameIdx, slot.leftDispMap, slot.rightDispMap);
+            slot.frameIdx = -1;
+        };
+
+        auto start = chrono::high_resolution_clock::now();
+        for (;; numFrames++)
+        {
+            // The slot of frame numFrames - numSlots, the oldest one in flight
+            auto &slot = slots[numFrames % numSlots];
+            finishSlot(slot);
+
+            // The source decodes the next frame while the device works on the ones in flight
+            if (!source(slot.leftImg, slot.rightImg))
+                break;
+            slot.frameIdx = numFrames;
+            slot.leftDispMap.resize(numPixels);
+            slot.rightDispMap.resize(numPixels);
+
+            vector<cl::Event> uploadEvents(2);
+            uploadQueue.enqueueWriteBuffer(slot.leftImgBuffer, CL_FALSE, 0, numPixels, slot.leftImg.data(), NULL, &uploadEvents[0]);
+            uploadQueue.enqueueWriteBuffer(slot.rightImgBuffer, CL_FALSE, 0, numPixels, slot.rightImg.data(), NULL, &uploadEvents[1]);
+
+            vector<cl::Event> computeEvents(2);
+            enqueue_tiled_kernel(queue, zncc_kernel, tileWidth, tileHeight, slot.leftImgBuffer, slot.rightImgBuffer, slot.leftDispMapBuffer, znccParams, &uploadEvents, &computeEvents[0]);
+            enqueue_tiled_kernel(queue, zncc_kernel, tileWidth, tileHeight, slot.rightImgBuffer, slot.leftImgBuffer, slot.rightDispMapBuffer, znccParams, &uploadEvents, &computeEvents[1]);
+
+            slot.downloadEvents.assign(2, cl::Event());
+            downloadQueue.enqueueReadBuffer(slot.leftDispMapBuffer, CL_FALSE, 0, mapBytes, slot.leftDispMap.data(), &computeEvents, &slot.downloadEvents[0]);
+            downloadQueue.enqueueReadBuffer(slot.rightDispMapBuffer, CL_FALSE, 0, mapBytes, slot.rightDispMap.data(), &computeEvents, &slot.downloadEvents[1]);
+
+            uploadQueue.flush();
+            queue.flush();
+            downloadQueue.flush();
+        }
+
+        // Drain the frames still in flight, oldest first
+        for (int s = 1; s < numSlots; s++)
+            finishSlot(slots[(numFrames + s) % numSlots]);
+
+        auto elapsedUs = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count();
+        cout << "# OpenCL stream: " << numFrames << " frames, " << numSlots << " in flight, " << elapsedUs << " us, "
+             << (elapsedUs > 0 ? numFrames * 1e6 / elapsedUs : 0.0) << " frames/s" << endl;
+    }
+    catch (const cl::Error &error)
+    {
+        cout << error.what() << ": " << get_cl_err(error.err()) << endl;
+    }
+
+    return numFrames;
+}
+
+// Left and right disparity maps of OPENCL_TILED kept on the device, in buffers of their own
+struct OpenclDisparityMaps
+{
+    int platformId;
+    cl::Buffer leftDispMapBuffer;
+    cl::Buffer rightDispMapBuffer;
+};
+
+shared_ptr<OpenclDisparityMaps> zncc_opencl_device_maps(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    try
+    {
+        auto [context, queue, program] = configure_opencl("zncc_kernels_tiled.cl", znccParams.platformId);
+        cl::Kernel zncc_kernel(program, "zncc_tiled_kernel");
+
+        auto [tileWidth, tileHeight] = pick_local_tile(opencl_device(znccParams.platformId).device, zncc_kernel, znccParams);
+        if (tileWidth == 0)
+        {
+            cout << "# OpenCL tiles of winSize " << znccParams.winSize << ", maxDisp " << znccParams.maxDisp << " do not fit in local memory, post-processing on the host" << endl;
+            return nullptr;
+        }
+
+        const size_t numPixels = leftImg.size();
+        const size_t mapBytes = numPixels * sizeof(disp_t);
+        auto maps = make_shared<OpenclDisparityMaps>(OpenclDisparityMaps{znccParams.platformId, cl::Buffer(context, CL_MEM_READ_WRITE, mapBytes, NULL, NULL), cl::Buffer(context, CL_MEM_READ_WRITE, mapBytes, NULL, NULL)});
+        cl::Buffer leftImgBuffer = input_buffer(znccParams.platformId, "leftImg", leftImg);
+        cl::Buffer rightImgBuffer = input_buffer(znccParams.platformId, "rightImg", rightImg);
+
+        enqueue_tiled_kernel(queue, zncc_kernel, tileWidth, tileHeight, leftImgBuffer, rightImgBuffer, maps->leftDispMapBuffer, znccParams);
+        enqueue_tiled_kernel(queue, zncc_kernel, tileWidth, tileHeight, rightImgBuffer, leftImgBuffer, maps->rightDispMapBuffer, znccParams);
+        queue.finish();
+
+        leftDispMap.clear();
+        rightDispMap.clear();
+        if (znccParams.readIntermediateMaps)
+        {
+            leftDispMap.resize(numPixels);
+            rightDispMap.resize(numPixels);
+            queue.enqueueReadBuffer(maps->leftDispMapBuffer, CL_TRUE, 0, mapBytes, leftDispMap.data());
+            queue.enqueueReadBuffer(maps->rightDispMapBuffer, CL_TRUE, 0, mapBytes, rightDispMap.data());
+        }
+
+        return maps;
+    }
+    catch (const cl::Error &error)
+    {
+        cout << error.what() << ": " << get_cl_err(error.err()) << endl;
+    }
+
+    return nullptr;
+}
+
+long long post_proc_opencl(const OpenclDisparityMaps &maps, DispMap &dispMap, DispMap &dispMapLeft, DispMap &dispMapRight, DispMap &dispMapCC, DispMap &dispMapOC, const ZnccParams &znccParams)
+{
+    long long postProcUs = 0;
+
+    try
+    {
+        auto [context, queue, program] = configure_opencl("zncc_kernels_postproc.cl", maps.platformId);
+        const size_t numPixels = static_cast<size_t>(znccParams.width) * znccParams.height;
+        const size_t mapBytes = numPixels * sizeof(disp_t);
+
+        // The stages follow each other on the in-order queue, the events are only kept for profiling
+        vector<cl::Event> events;
+        auto enqueue = [&](const cl::Kernel &kernel)
+        {
+            events.emplace_back();
+            queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(numPixels), cl::NullRange, NULL, &events.back());
+        };
+        auto normalize = [&](const cl::Buffer &buffer, const string &role)
+        {
+            cl::Buffer result = pooled_buffer(maps.platformId, role, mapBytes, CL_MEM_READ_WRITE);
+            cl::Kernel normalize_kernel(program, "normalize_kernel");
+            normalize_kernel.setArg(0, buffer);
+            normalize_kernel.setArg(1, result);
+            normalize_kernel.setArg(2, znccParams.maxDisp);
+            enqueue(normalize_kernel);
+            return result;
+        };
+
+        // Same chain as post_proc_pipeline, a disabled stage passes its input on
+        cl::Buffer ccBuffer = maps.leftDispMapBuffer;
+        if (znccParams.withCrossChecking)
+        {
+            ccBuffer = pooled_buffer(maps.platformId, "postProc.dispMapCC", mapBytes, CL_MEM_READ_WRITE);
+            cl::Kernel crosscheck_kernel(program, "crosscheck_kernel");
+            crosscheck_kernel.setArg(0, maps.leftDispMapBuffer);
+            crosscheck_kernel.setArg(1, maps.rightDispMapBuffer);
+            crosscheck_kernel.setArg(2, ccBuffer);
+            crosscheck_kernel.setArg(3, znccParams.ccThresh);
+            enqueue(crosscheck_kernel);
+        }
+
+        cl::Buffer ocBuffer = ccBuffer;
+        if (znccParams.withOcclusionFilling)
+        {
+            ocBuffer = pooled_buffer(maps.platformId, "postProc.dispMapOC", mapBytes, CL_MEM_READ_WRITE);
+            cl::Kernel fill_occlusion_kernel(program, "fill_occlusion_kernel");
+            fill_occlusion_kernel.setArg(0, ccBuffer);
+            fill_occlusion_kernel.setArg(1, ocBuffer);
+            fill_occlusion_kernel.setArg(2, znccParams.width);
+            enqueue(fill_occlusion_kernel);
+        }
+
+        // Normalization takes the cross-checked map, as post_proc_pipeline does
+        cl::Buffer dispMapBuffer = ocBuffer;
+        cl::Buffer leftBuffer = maps.leftDispMapBuffer;
+        cl::Buffer rightBuffer = maps.rightDispMapBuffer;
+        if (znccParams.withNormalization)
+        {
+            dispMapBuffer = normalize(ccBuffer, "postProc.dispMap");
+            if (znccParams.readIntermediateMaps)
+            {
+                leftBuffer = normalize(maps.leftDispMapBuffer, "postProc.dispMapLeft");
+                rightBuffer = normalize(maps.rightDispMapBuffer, "postProc.dispMapRight");
+            }
+        }
+        queue.finish();
+
+        // Only the final map crosses the bus, unless the intermediate ones were asked for
+        auto read = [&](const cl::Buffer &buffer, DispMap &map)
+        {
+            map.resize(numPixels);
+            queue.enqueueReadBuffer(buffer, CL_TRUE, 0, mapBytes, map.data());
+        };
+        read(dispMapBuffer, dispMap);
+        if (znccParams.readIntermediateMaps)
+        {
+            read(leftBuffer, dispMapLeft);
+            read(rightBuffer, dispMapRight);
+            read(ccBuffer, dispMapCC);
+            read(ocBuffer, dispMapOC);
+        }
+
+        if (!events.empty())
+            postProcUs = (events.back().getProfilingInfo<CL_PROFILING_COMMAND_END>() - events.front().getProfilingInfo<CL_PROFILING_COMMAND_START>()) / 1000;
+        cout << "# OpenCL post-processing: " << events.size() << " kernels, " << postProcUs << " us on the device" << endl;
+    }
+    catch (const cl::Error &error)
+    {
+        cout << error.what() << ": " << get_cl_err(error.err()) << endl;
+    }
+
+    return postProcUs;
+}
 
-// void zncc_opencl_pipe(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+// void zncc_opencl_pipe(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
 // {
 //     try
 //     {
@@ -264,9 +784,9 @@ void zncc_opencl_opt3(vector<unsigned char> &leftDispMap, vector<unsigned char>
 
 //         // Copy the output data back to the host
 //         // unsigned char *tmpDisparity;
-//         queue.enqueueReadBuffer(dispMapBuffer, CL_TRUE, 0, inputSize, &dispMap[0]);
+//         read_output(znccParams.platformId, dispMapBuffer, dispMap);
 //     }
-//     catch (cl::Error error)
+//     catch (const cl::Error &error)
 //     {
 //         cout << error.what() << ": " << get_cl_err(error.err()) << endl;
 //     }
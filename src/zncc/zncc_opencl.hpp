@@ -3,17 +3,69 @@
 #include <iostream>
 #include <vector>
 #include <tuple>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <filesystem>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include "../utils/clchecks.hpp"
 #include "zncc_common.hpp"
 
 using namespace std;
 
-void zncc_opencl(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool reverse);
+// Hits and misses of the OpenCL caches: contexts per platform, programs in memory, then program binaries on disk,
+// and device buffers
+struct OpenclCacheStats
+{
+    int contextHits = 0;
+    int contextMisses = 0;
+    int programHits = 0;
+    int programMisses = 0;
+    int binaryLoads = 0;
+    int sourceBuilds = 0;
+    long long buildUs = 0;
+    int bufferHits = 0;
+    int bufferMisses = 0;
+    int hostBuffers = 0; // pooled buffers allocated in host memory, on devices sharing it
+};
 
-void zncc_opencl_opt1(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+OpenclCacheStats getOpenclCacheStats();
+void printOpenclCacheStats();
 
-void zncc_opencl_opt(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool reverse);
+void zncc_opencl(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool reverse);
 
-void zncc_opencl_opt3(vector<unsigned char> &leftDispMap, vector<unsigned char> &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+void zncc_opencl_opt1(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
 
-void zncc_opencl_pipe(vector<unsigned char> &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+void zncc_opencl_opt(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams, bool reverse);
+
+void zncc_opencl_opt3(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+
+// 2D work-groups sharing the left and right image tiles in local memory, the tile size is picked from the device limits
+void zncc_opencl_tiled(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+
+// Next stereo pair of a sequence, grey images of the ZnccParams size, false once the sequence is over
+using ZnccFrameSource = function<bool(vector<unsigned char> &leftImg, vector<unsigned char> &rightImg)>;
+
+// Left and right disparity maps of a frame, called in frame order
+using ZnccFrameSink = function<void(int frameIdx, DispMap &leftDispMap, DispMap &rightDispMap)>;
+
+// Throughput mode for sequences: keeps znccParams.framesInFlight frames on the device, with uploads, kernels and
+// downloads on separate queues chained by events. The source and the sink run on the host meanwhile.
+// Returns the number of frames processed.
+int zncc_opencl_stream(const ZnccFrameSource &source, const ZnccFrameSink &sink, const ZnccParams &znccParams);
+
+// Left and right disparity maps kept on the OpenCL device, so the post-processing can run there too
+struct OpenclDisparityMaps;
+
+// OPENCL_TILED maps left on the device, read back into leftDispMap and rightDispMap only with
+// znccParams.readIntermediateMaps, else both are left empty. nullptr if the tiles do not fit in local memory
+// or on OpenCL errors.
+shared_ptr<OpenclDisparityMaps> zncc_opencl_device_maps(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+
+// Cross checking, occlusion filling and normalization of post_proc_pipeline chained on the device. Only dispMap is read
+// back, the other maps too with znccParams.readIntermediateMaps. Returns the device time of the stages in us.
+long long post_proc_opencl(const OpenclDisparityMaps &maps, DispMap &dispMap, DispMap &dispMapLeft, DispMap &dispMapRight, DispMap &dispMapCC, DispMap &dispMapOC, const ZnccParams &znccParams);
+
+void zncc_opencl_pipe(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
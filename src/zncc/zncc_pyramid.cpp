@@ -0,0 +1,137 @@
+#include "zncc_pyramid.hpp"
+
+// Disparities of the coarser level, upsampled to the size of this level and doubled
+vector<int> predictDisparity(const DispMap &coarseDispMap, int coarseWidth, int coarseHeight, int width, int height)
+{
+    // nearest neighbour, odd sizes lose their last row or column when downsampled, repeat the one before
+    vector<int> predDisp(width * height);
+    for (int y = 0; y < height; y++)
+    {
+        const disp_t *row = &coarseDispMap[min(y / 2, coarseHeight - 1) * coarseWidth];
+        for (int x = 0; x < width; x++)
+        {
+            predDisp[y * width + x] = 2 * row[min(x / 2, coarseWidth - 1)];
+        }
+    }
+
+    return predDisp;
+}
+
+// Best disparity of each pixel among the refineRadius disparities on each side of its prediction
+template <typename ScoreFn>
+void zncc_refine(DispMap &dispMap, const vector<int> &predDisp, const ZnccParams &znccParams, ScoreFn score)
+{
+#pragma omp parallel for schedule(dynamic)
+    for (int y = 0; y < znccParams.height; y++)
+    {
+        for (int x = 0; x < znccParams.width; x++)
+        {
+            const int idx = y * znccParams.width + x;
+            const int d0 = max(0, predDisp[idx] - znccParams.refineRadius);
+            const int d1 = min(znccParams.maxDisp - 1, predDisp[idx] + znccParams.refineRadius);
+
+            double maxZncc = -1.0;
+            int bestDisp = min(d0, znccParams.maxDisp - 1);
+
+            for (int d = d0; d <= d1; d++)
+            {
+                double znccVal = score(x, y, d);
+                if (znccVal > maxZncc)
+                {
+                    maxZncc = znccVal;
+                    bestDisp = d;
+                }
+            }
+
+            dispMap[idx] = static_cast<disp_t>(bestDisp);
+        }
+    }
+}
+
+void zncc_pyramid(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    // Level 0 is the input, each level above halves the image and the disparity range
+    vector<ZnccParams> levelParams{znccParams};
+    for (int level = 1; level < znccParams.pyramidLevels; level++)
+    {
+        ZnccParams params = levelParams.back();
+        if (params.width / 2 < params.winSize || params.height / 2 < params.winSize)
+            break;
+
+        params.width /= 2;
+        params.height /= 2;
+        params.maxDisp = (params.maxDisp + 1) / 2;
+        levelParams.push_back(params);
+    }
+
+    const int numLevels = static_cast<int>(levelParams.size());
+    auto leftLevels = buildPyramid(leftImg, znccParams.width, znccParams.height, numLevels);
+    auto rightLevels = buildPyramid(rightImg, znccParams.width, znccParams.height, numLevels);
+    auto leftLevel = [&](int level) -> const vector<unsigned char> & { return level == 0 ? leftImg : leftLevels[level]; };
+    auto rightLevel = [&](int level) -> const vector<unsigned char> & { return level == 0 ? rightImg : rightLevels[level]; };
+
+    const int coarsest = static_cast<int>(levelParams.size()) - 1;
+    const ZnccParams &coarseParams = levelParams[coarsest];
+    cout << "# Pyramid level " << coarsest << ": " << coarseParams.width << "x" << coarseParams.height << ", full search over " << coarseParams.maxDisp << " disparities" << endl;
+
+    DispMap leftDisp(coarseParams.width * coarseParams.height);
+    DispMap rightDisp(coarseParams.width * coarseParams.height);
+    zncc(leftDisp, rightDisp, leftLevel(coarsest), rightLevel(coarsest), coarseParams);
+
+    for (int level = coarsest - 1; level >= 0; level--)
+    {
+        const ZnccParams &params = levelParams[level];
+        const ZnccParams &coarser = levelParams[level + 1];
+        const auto &left = leftLevel(level);
+        const auto &right = rightLevel(level);
+        cout << "# Pyramid level " << level << ": " << params.width << "x" << params.height << ", refining +/- " << params.refineRadius << " disparities" << endl;
+
+        auto leftPred = predictDisparity(leftDisp, coarser.width, coarser.height, params.width, params.height);
+        auto rightPred = predictDisparity(rightDisp, coarser.width, coarser.height, params.width, params.height);
+
+        auto leftIntegral = buildIntegralImage(left, params.width, params.height);
+        auto rightIntegral = buildIntegralImage(right, params.width, params.height);
+
+        auto leftScore = [&](int x, int y, int d)
+        { return calculateZnccIntegral(x, y, d, left, right, leftIntegral, rightIntegral, params); };
+
+        // the right map follows the convention of zncc() for the same parameters
+        auto rightScore = [&](int x, int y, int d)
+        {
+            if (params.fusedLeftRight)
+                return x + d < params.width ? leftScore(x + d, y, d) : -1.0;
+            return calculateZnccIntegral(x, y, d, right, left, rightIntegral, leftIntegral, params);
+        };
+
+        leftDisp.assign(params.width * params.height, 0);
+        rightDisp.assign(params.width * params.height, 0);
+        zncc_refine(leftDisp, leftPred, params, leftScore);
+        zncc_refine(rightDisp, rightPred, params, rightScore);
+    }
+
+    leftDispMap = leftDisp;
+    rightDispMap = rightDisp;
+}
+
+ZnccResult zncc_pyramid_pipeline(const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    int numPixels = znccParams.width * znccParams.height;
+    ZnccResult znccResult;
+    znccResult.dispMap = DispMap(numPixels);
+    znccResult.dispMapLeft = DispMap(numPixels);
+    znccResult.dispMapRight = DispMap(numPixels);
+
+    if (!dispRangeFits(znccParams))
+        return znccResult;
+
+    cout << "## ZNCC pyramid (" << znccParams.pyramidLevels << " levels) ...\n";
+    {
+        Timer timer;
+        zncc_pyramid(znccResult.dispMapLeft, znccResult.dispMapRight, leftImg, rightImg, znccParams);
+        if (znccParams.subPixel != SubPixelFit::NONE)
+            zncc_subpixel(znccResult.dispMapLeftSubPixel, znccResult.dispMapRightSubPixel, znccResult.dispMapLeft, znccResult.dispMapRight, leftImg, rightImg, znccParams, znccParams.fusedLeftRight);
+        znccResult.znccTime = timer.getDuration();
+    }
+
+    return znccResult;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include "../utils/datatools.hpp"
+#include "zncc.hpp"
+
+using namespace std;
+
+// Coarse-to-fine ZNCC: the full disparity range is searched with znccParams.method on the coarsest of
+// znccParams.pyramidLevels half-resolution levels only. Each finer level searches refineRadius
+// disparities around the upsampled disparity of the level below.
+void zncc_pyramid(DispMap &leftDispMap, DispMap &rightDispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+ZnccResult zncc_pyramid_pipeline(const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
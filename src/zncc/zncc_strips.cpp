@@ -0,0 +1,97 @@
+#include "zncc_strips.hpp"
+
+size_t stripBytesPerRow(const ZnccParams &znccParams)
+{
+    const size_t width = znccParams.width;
+    size_t bytes = 2 * width * znccParams.resizeFactor * znccParams.resizeFactor; // input rows averaged into one
+    bytes += 2 * width; // grey rows
+
+    // sum and squared sum tables of both images
+    if (znccParams.method == ZnccMethod::INTEGRAL || znccParams.method == ZnccMethod::COST_VOLUME)
+        bytes += 4 * (width + 1) * sizeof(long long);
+
+    // left, right, cross-checked, filled and output maps, and the normalized copies of left and right
+    bytes += 7 * width * sizeof(disp_t);
+    return bytes;
+}
+
+int stripHeightForBudget(const ZnccParams &znccParams, size_t memoryBudget)
+{
+    const long long bandRows = static_cast<long long>(memoryBudget / stripBytesPerRow(znccParams));
+    const long long rows = bandRows - 2 * (znccParams.winSize / 2) - 1;
+    return static_cast<int>(clamp<long long>(rows, 1, max(1, znccParams.height)));
+}
+
+// Rows [y0, y1) of the working resolution, box-averaged from the full-resolution rows of the mapping. The rows
+// before nextY0, the first row of the next band, are released from the mapping.
+vector<unsigned char> readBand(const MappedGrayImage &img, int y0, int y1, int nextY0, int factor)
+{
+    const size_t width = img.width;
+    const size_t offset = img.pixels - img.file->data();
+    const unsigned char *first = img.pixels + static_cast<size_t>(y0) * factor * width;
+    vector<unsigned char> rows(first, first + static_cast<size_t>(y1 - y0) * factor * width);
+    img.file->release(offset + static_cast<size_t>(y0) * factor * width, static_cast<size_t>(nextY0 - y0) * factor * width);
+    if (factor == 1)
+        return rows;
+
+    return downsample(rows, img.width, (y1 - y0) * factor, factor);
+}
+
+bool zncc_strips(const string &leftPath, const string &rightPath, const string &outPath, const ZnccParams &znccParams, size_t memoryBudget)
+{
+    MappedGrayImage left, right;
+    if (!openGrayImage(leftPath, left) || !openGrayImage(rightPath, right))
+        return false;
+    if (left.width != right.width || left.height != right.height)
+    {
+        cout << "# Strips: " << leftPath << " and " << rightPath << " differ in size" << endl;
+        return false;
+    }
+
+    ZnccParams params = znccParams;
+    params.width = left.width / params.resizeFactor;
+    params.height = left.height / params.resizeFactor;
+    params.pyramidLevels = 1;
+    params.subPixel = SubPixelFit::NONE;
+    if (!dispRangeFits(params))
+        return false;
+
+    GrayImageWriter writer(outPath, params.width, params.height, 8 * sizeof(disp_t));
+    if (!writer.valid())
+        return false;
+
+    // the halo rows give the windows of the first and last rows of a band the same rows as in the whole image. Cross
+    // checking reads the row above for pixels left of their disparity, so that row needs its whole window too.
+    const int halo = params.winSize / 2;
+    const int haloAbove = halo + 1;
+    const int stripHeight = stripHeightForBudget(params, memoryBudget);
+    const int numStrips = (params.height + stripHeight - 1) / stripHeight;
+    cout << "# Strips: " << numStrips << " bands of " << stripHeight << " rows plus " << haloAbove + halo << " halo rows, about "
+         << (stripHeight + haloAbove + halo) * stripBytesPerRow(params) / (1 << 20) << " MB each" << endl;
+
+    long long znccTime = 0;
+    long long postProcTime = 0;
+    for (int y0 = 0; y0 < params.height; y0 += stripHeight)
+    {
+        const int y1 = min(params.height, y0 + stripHeight);
+        const int bandY0 = max(0, y0 - haloAbove);
+        const int bandY1 = min(params.height, y1 + halo);
+
+        const int nextBandY0 = y1 < params.height ? max(0, y1 - haloAbove) : bandY1;
+
+        ZnccParams bandParams = params;
+        bandParams.height = bandY1 - bandY0;
+        auto leftBand = readBand(left, bandY0, bandY1, nextBandY0, params.resizeFactor);
+        auto rightBand = readBand(right, bandY0, bandY1, nextBandY0, params.resizeFactor);
+
+        auto result = zncc_pipeline(leftBand, rightBand, bandParams);
+        post_proc_pipeline(result, bandParams);
+        writer.writeRows(y0, &result.dispMap[(y0 - bandY0) * params.width], y1 - y0);
+
+        znccTime += result.znccTime;
+        postProcTime += result.postProcTime;
+    }
+
+    cout << "# Strips: " << params.width << "x" << params.height << " written to " << outPath << ", zncc " << znccTime << " us, postproc " << postProcTime << " us" << endl;
+    return true;
+}
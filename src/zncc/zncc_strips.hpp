@@ -0,0 +1,25 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include "../utils/datatools.hpp"
+#include "zncc.hpp"
+
+using namespace std;
+
+// Bytes of a band that grow with its rows, per row of the working resolution: the full-resolution input rows of
+// both images, their grey rows, the integral tables of the methods using them and the maps of zncc_pipeline and
+// post_proc_pipeline. The per-thread row buffers of the methods only depend on the width and come on top.
+size_t stripBytesPerRow(const ZnccParams &znccParams);
+
+// Output rows per band so that a band with its halo rows stays within memoryBudget bytes, at least one
+int stripHeightForBudget(const ZnccParams &znccParams, size_t memoryBudget);
+
+// Matches and post-processes a pair of 8-bit .pgm or .raw images in horizontal bands, each read from the input
+// mappings with winSize / 2 halo rows below and one more above, and writes the rows of znccResult.dispMap to outPath (.pgm or
+// .raw) as each band finishes. Peak memory follows the band height, picked from memoryBudget, instead of the image
+// size. The width and height of znccParams are set from the images and resizeFactor, the maps are the ones of the
+// whole image except for occlusion filling, whose fallback neighbour is read from the first row of the band, and
+// pyramidLevels and subPixel are not used. False when an image cannot be read or written.
+bool zncc_strips(const string &leftPath, const string &rightPath, const string &outPath, const ZnccParams &znccParams, size_t memoryBudget);
@@ -0,0 +1,144 @@
+#include "zncc_templated.hpp"
+
+// WIN_SIZE or MAX_DISP of 0 takes the size from znccParams
+template <int WIN_SIZE, int MAX_DISP, typename Acc>
+void score_pixel_templated(int x, int y, vector<double> &znccVals, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    const int width = znccParams.width;
+    const int height = znccParams.height;
+    const int winSize = WIN_SIZE > 0 ? WIN_SIZE : znccParams.winSize;
+    const int maxDisp = MAX_DISP > 0 ? MAX_DISP : znccParams.maxDisp;
+    const int halfWinSize = winSize / 2;
+    const long long count = static_cast<long long>(winSize) * winSize;
+
+    // Left windows clipped by the image border take the runtime path of zncc_single
+    if (y - halfWinSize < 0 || y + halfWinSize >= height || x - halfWinSize < 0 || x + halfWinSize >= width)
+    {
+        double mean1 = calculateMean(x, y, leftImg, znccParams);
+        for (int d = 0; d < maxDisp; d++)
+        {
+            double mean2 = calculateMean(x - d, y, rightImg, znccParams);
+            znccVals[d] = calculateZncc(x, y, d, mean1, mean2, leftImg, rightImg, znccParams);
+        }
+        return;
+    }
+
+    // Full windows: constant trip counts, no index division, exact integer sums
+    const unsigned char *win1 = &leftImg[(y - halfWinSize) * width + x - halfWinSize];
+    const unsigned char *win2 = &rightImg[(y - halfWinSize) * width + x - halfWinSize];
+
+    Acc sum1 = 0, sqSum1 = 0;
+    for (int j = 0; j < winSize; j++)
+    {
+        const unsigned char *row1 = win1 + j * width;
+        for (int i = 0; i < winSize; i++)
+        {
+            Acc val1 = row1[i];
+            sum1 += val1;
+            sqSum1 += val1 * val1;
+        }
+    }
+
+    // Disparities past x - halfWinSize put the right window across the left border of the image
+    const int numFull = min(maxDisp, x - halfWinSize + 1);
+    for (int d = 0; d < numFull; d++)
+    {
+        Acc sum2 = 0, sqSum2 = 0, crossSum = 0;
+        for (int j = 0; j < winSize; j++)
+        {
+            const unsigned char *row1 = win1 + j * width;
+            const unsigned char *row2 = win2 + j * width - d;
+            for (int i = 0; i < winSize; i++)
+            {
+                Acc val1 = row1[i];
+                Acc val2 = row2[i];
+                sum2 += val2;
+                sqSum2 += val2 * val2;
+                crossSum += val1 * val2;
+            }
+        }
+
+        ZnccSums sums{count, static_cast<long long>(sum1), static_cast<long long>(sum2), static_cast<long long>(sqSum1), static_cast<long long>(sqSum2), static_cast<long long>(crossSum)};
+        znccVals[d] = calculateZnccFromSums(sums, sums.sum1, count, sums.sum2, count);
+    }
+
+    // Clipped disparities: only the window columns from i0 on overlap, the right mean is taken over them too and
+    // the left one over the full window, as calculateZncc does
+    for (int d = numFull; d < maxDisp; d++)
+    {
+        const int i0 = min(winSize, d - (x - halfWinSize));
+        Acc overlapSum1 = 0, overlapSqSum1 = 0, sum2 = 0, sqSum2 = 0, crossSum = 0;
+        for (int j = 0; j < winSize; j++)
+        {
+            const unsigned char *row1 = win1 + j * width;
+            const unsigned char *row2 = win2 + j * width - d;
+            for (int i = i0; i < winSize; i++)
+            {
+                Acc val1 = row1[i];
+                Acc val2 = row2[i];
+                overlapSum1 += val1;
+                overlapSqSum1 += val1 * val1;
+                sum2 += val2;
+                sqSum2 += val2 * val2;
+                crossSum += val1 * val2;
+            }
+        }
+
+        const long long overlapCount = static_cast<long long>(winSize - i0) * winSize;
+        ZnccSums sums{overlapCount, static_cast<long long>(overlapSum1), static_cast<long long>(sum2), static_cast<long long>(overlapSqSum1), static_cast<long long>(sqSum2), static_cast<long long>(crossSum)};
+        znccVals[d] = calculateZnccFromSums(sums, static_cast<long long>(sum1), count, sums.sum2, overlapCount);
+    }
+}
+
+// Window sizes and disparity counts used in production, int32 sums are exact for all of them
+#define ZNCC_KERNELS_FOR_WIN(win)                                      \
+    {make_tuple(win, 32), score_pixel_templated<win, 32, int>},   \
+    {make_tuple(win, 64), score_pixel_templated<win, 64, int>},   \
+    {make_tuple(win, 128), score_pixel_templated<win, 128, int>}
+
+const map<tuple<int, int>, ZnccScoreFn> ZnccKernelTable = {
+    ZNCC_KERNELS_FOR_WIN(9),
+    ZNCC_KERNELS_FOR_WIN(15),
+    ZNCC_KERNELS_FOR_WIN(25),
+    ZNCC_KERNELS_FOR_WIN(35),
+};
+
+#undef ZNCC_KERNELS_FOR_WIN
+
+ZnccScoreFn getZnccScoreFn(int winSize, int maxDisp, bool *specialised)
+{
+    auto it = ZnccKernelTable.find(make_tuple(winSize, maxDisp));
+    if (specialised)
+        *specialised = it != ZnccKernelTable.end();
+    return it != ZnccKernelTable.end() ? it->second : score_pixel_templated<0, 0, long long>;
+}
+
+void zncc_templated(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams)
+{
+    bool specialised = false;
+    const ZnccScoreFn scorePixel = getZnccScoreFn(znccParams.winSize, znccParams.maxDisp, &specialised);
+    cout << "# ZNCC kernel: " << (specialised ? "specialised" : "generic") << " for winSize " << znccParams.winSize << ", maxDisp " << znccParams.maxDisp << endl;
+
+#pragma omp parallel for schedule(dynamic)
+    for (int y = 0; y < znccParams.height; y++)
+    {
+        vector<double> znccVals(znccParams.maxDisp);
+        for (int x = 0; x < znccParams.width; x++)
+        {
+            scorePixel(x, y, znccVals, leftImg, rightImg, znccParams);
+
+            double maxZncc = -1.0;
+            int bestDisp = 0;
+            for (int d = 0; d < znccParams.maxDisp; d++)
+            {
+                if (znccVals[d] > maxZncc)
+                {
+                    maxZncc = znccVals[d];
+                    bestDisp = d;
+                }
+            }
+
+            dispMap[y * znccParams.width + x] = static_cast<disp_t>(bestDisp);
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <tuple>
+#include "zncc_common.hpp"
+
+using namespace std;
+
+// ZNCC scores of all disparities of a pixel, specialised at compile time on window size, disparity
+// count and accumulator type. The generic kernel reads the sizes from ZnccParams at runtime instead.
+using ZnccScoreFn = void (*)(int x, int y, vector<double> &znccVals, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);
+
+// Kernel for the given window size and disparity count, the generic kernel if there is no specialisation
+ZnccScoreFn getZnccScoreFn(int winSize, int maxDisp, bool *specialised = nullptr);
+
+void zncc_templated(DispMap &dispMap, const vector<unsigned char> &leftImg, const vector<unsigned char> &rightImg, const ZnccParams &znccParams);